@@ -0,0 +1,78 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file i2c.h
+ * @brief Minimal host replacement of the ESP-IDF I2C driver, implemented by the replay backend.
+ */
+
+#ifndef HOST_INCLUDE_DRIVER_I2C_H_
+#define HOST_INCLUDE_DRIVER_I2C_H_
+
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+typedef enum {
+	GPIO_NUM_21 = 21, GPIO_NUM_22 = 22, GPIO_NUM_23 = 23
+} gpio_num_t;
+
+typedef enum {
+	GPIO_PULLUP_DISABLE = 0, GPIO_PULLUP_ENABLE = 1
+} gpio_pullup_t;
+
+typedef enum {
+	I2C_MODE_SLAVE = 0, I2C_MODE_MASTER = 1
+} i2c_mode_t;
+
+typedef enum {
+	I2C_NUM_0 = 0, I2C_NUM_1 = 1
+} i2c_port_t;
+
+typedef enum {
+	I2C_MASTER_WRITE = 0, I2C_MASTER_READ = 1
+} i2c_rw_t;
+
+typedef enum {
+	I2C_MASTER_ACK = 0, I2C_MASTER_NACK = 1
+} i2c_ack_type_t;
+
+typedef struct {
+	i2c_mode_t mode;
+	int sda_io_num;
+	int scl_io_num;
+	gpio_pullup_t sda_pullup_en;
+	gpio_pullup_t scl_pullup_en;
+	struct {
+		uint32_t clk_speed;
+	} master;
+} i2c_config_t;
+
+typedef void *i2c_cmd_handle_t;
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t *i2c_conf);
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode,
+		size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags);
+i2c_cmd_handle_t i2c_cmd_link_create(void);
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle);
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle);
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle);
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data,
+		bool ack_en);
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd_handle, uint8_t *data,
+		i2c_ack_type_t ack);
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle,
+		TickType_t ticks_to_wait);
+
+#endif /* HOST_INCLUDE_DRIVER_I2C_H_ */
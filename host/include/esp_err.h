@@ -0,0 +1,37 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file esp_err.h
+ * @brief Minimal host replacement of the ESP-IDF esp_err.h, used by the host backends.
+ */
+
+#ifndef HOST_INCLUDE_ESP_ERR_H_
+#define HOST_INCLUDE_ESP_ERR_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef int32_t esp_err_t;
+
+#define ESP_OK						0
+#define ESP_FAIL					-1
+#define ESP_ERR_NO_MEM				0x101
+#define ESP_ERR_INVALID_ARG			0x102
+#define ESP_ERR_INVALID_STATE		0x103
+#define ESP_ERR_TIMEOUT				0x107
+
+#endif /* HOST_INCLUDE_ESP_ERR_H_ */
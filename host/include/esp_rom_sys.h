@@ -0,0 +1,31 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file esp_rom_sys.h
+ * @brief Minimal host replacement of ESP-IDF esp_rom_sys.h, used by the host backends.
+ */
+
+#ifndef HOST_INCLUDE_ESP_ROM_SYS_H_
+#define HOST_INCLUDE_ESP_ROM_SYS_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Busy wait, virtual on host like vTaskDelay()
+ */
+void esp_rom_delay_us(uint32_t us);
+
+#endif /* HOST_INCLUDE_ESP_ROM_SYS_H_ */
@@ -0,0 +1,31 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file esp_timer.h
+ * @brief Minimal host replacement of the ESP-IDF esp_timer.h, used by the host backends.
+ */
+
+#ifndef HOST_INCLUDE_ESP_TIMER_H_
+#define HOST_INCLUDE_ESP_TIMER_H_
+
+#include <stdint.h>
+
+/**
+ * @brief Virtual time in microseconds, driven by the replayed trace or the simulator clock
+ */
+int64_t esp_timer_get_time(void);
+
+#endif /* HOST_INCLUDE_ESP_TIMER_H_ */
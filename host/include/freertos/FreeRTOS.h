@@ -0,0 +1,46 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file FreeRTOS.h
+ * @brief Minimal host replacement of the FreeRTOS port used by ESP-IDF, used by the host backends.
+ */
+
+#ifndef HOST_INCLUDE_FREERTOS_FREERTOS_H_
+#define HOST_INCLUDE_FREERTOS_FREERTOS_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <pthread.h>
+
+typedef uint32_t TickType_t;
+typedef int32_t BaseType_t;
+typedef uint32_t UBaseType_t;
+
+#define configTICK_RATE_HZ				100
+#define portTICK_PERIOD_MS				(1000 / configTICK_RATE_HZ)
+#define portMAX_DELAY					((TickType_t) 0xFFFFFFFF)
+#define pdMS_TO_TICKS(ms)				((TickType_t) ((ms) / portTICK_PERIOD_MS))
+#define pdTRUE							1
+#define pdFALSE							0
+#define pdPASS							pdTRUE
+
+typedef pthread_mutex_t portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED	PTHREAD_MUTEX_INITIALIZER
+#define portENTER_CRITICAL(mux)			pthread_mutex_lock(mux)
+#define portEXIT_CRITICAL(mux)			pthread_mutex_unlock(mux)
+
+#endif /* HOST_INCLUDE_FREERTOS_FREERTOS_H_ */
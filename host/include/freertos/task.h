@@ -0,0 +1,52 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file task.h
+ * @brief Minimal host replacement of FreeRTOS task.h, used by the host backends.
+ */
+
+#ifndef HOST_INCLUDE_FREERTOS_TASK_H_
+#define HOST_INCLUDE_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+typedef void *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define tskIDLE_PRIORITY				((UBaseType_t) 0)
+
+/**
+ * @brief Tasks are simulator threads; replay runs none and fails to create them
+ */
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth,
+		void *arg, UBaseType_t priority, TaskHandle_t *created);
+
+/**
+ * @brief Notify a task created by xTaskCreate(), any other handle is ignored
+ */
+BaseType_t xTaskNotifyGive(TaskHandle_t task);
+
+/**
+ * @brief Take notifications of the calling task, waiting on the simulator clock
+ */
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait);
+
+/**
+ * @brief Delay is virtual on host: a no-op in replay, a wait on the simulator clock
+ */
+void vTaskDelay(TickType_t ticks);
+
+#endif /* HOST_INCLUDE_FREERTOS_TASK_H_ */
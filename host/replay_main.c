@@ -0,0 +1,167 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file replay_main.c
+ * @brief Command line tool replaying a dumped trace through si7021.c.
+ *
+ * Every recorded write phase is mapped back to the library call that issued it, with deadline
+ * reads identified by the #SI7021_TRACE_OP_DEADLINE entry before their command. The call is
+ * made against the replay backend and its result printed. The trace recorded during replay is
+ * then compared with the input, and optionally dumped for diffing.
+ *
+ * Usage: si7021_replay <trace.bin> [retrace.bin]
+ */
+
+#include "si7021_replay.h"
+#include <string.h>
+
+/*
+ * A deadline entry names the API and carries the deadline the caller passed, the command it
+ * announces follows it directly.
+ */
+static void replay_deadline_call(const si7021_trace_entry_t *entry) {
+	int64_t deadline_us = si7021_replay_time(entry);
+	uint8_t command = entry->data[0];
+	const si7021_trace_entry_t *next;
+	float value = -999;
+	si7021_err_t err;
+
+	si7021_replay_skip();
+	next = si7021_replay_peek();
+	if (next == NULL || next->op != SI7021_TRACE_OP_WRITE || next->len == 0
+			|| next->data[0] != command) {
+		printf("deadline entry without its command, skipped\n");
+		return;
+	}
+	switch (command) {
+	case SI7021_MEASTEMP_NOHOLD_CMD:
+		err = si7021_read_temperature_deadline(deadline_us, &value);
+		printf("read_temperature_deadline -> %u %.2f\n", err, value);
+		break;
+	case SI7021_MEASRH_NOHOLD_CMD:
+		err = si7021_read_humidity_deadline(deadline_us, &value);
+		printf("read_humidity_deadline -> %u %.2f\n", err, value);
+		break;
+	default:
+		printf("deadline command 0x%02X unknown, skipped\n", command);
+		si7021_replay_skip();
+		break;
+	}
+}
+
+static void replay_call(const si7021_trace_entry_t *entry) {
+	if (entry->len == 0) {
+		printf("check_availability -> %u\n", si7021_check_availability());
+		return;
+	}
+	switch (entry->data[0]) {
+	case SI7021_MEASTEMP_NOHOLD_CMD:
+		printf("read_temperature -> %.2f\n", si7021_read_temperature());
+		break;
+	case SI7021_MEASRH_NOHOLD_CMD:
+		printf("read_humidity -> %.2f\n", si7021_read_humidity());
+		break;
+	case SI7021_READPREVTEMP_CMD:
+		printf("read_previous_temperature -> 0x%04X\n",
+				__si7021_read_previous_temperature());
+		break;
+	case SI7021_READRHT_REG_CMD:
+		printf("read_user_register -> 0x%02X\n", __si7021_read_user_register());
+		break;
+	case SI7021_WRITERHT_REG_CMD:
+		printf("write_user_register(0x%02X) -> %u\n", entry->data[1],
+				__si7021_write_user_register(entry->data[1]));
+		break;
+	case SI7021_WRITEHEATER_REG_CMD:
+		printf("set_heater_register(0x%02X) -> %u\n", entry->data[1],
+				si7021_set_heater_register(entry->data[1]));
+		break;
+	case SI7021_READHEATER_REG_CMD:
+		printf("get_heater_register -> 0x%02X\n", si7021_get_heater_register());
+		break;
+	case SI7021_SOFT_RESET_CMD:
+		printf("soft_reset -> %u\n", si7021_soft_reset());
+		break;
+	case SI7021_FIRMVERS_CMD >> 8:
+		printf("read_firmware_rev -> 0x%02X\n", si7021_read_firmware_rev());
+		break;
+	case SI7021_ID1_CMD >> 8:
+		printf("get_electronic_id -> 0x%016llX\n",
+				(unsigned long long) get_electronic_id());
+		break;
+	default:
+		printf("unknown command 0x%02X, skipped\n", entry->data[0]);
+		si7021_replay_skip();
+		break;
+	}
+}
+
+int main(int argc, char **argv) {
+	const si7021_trace_entry_t *entry, *original;
+	si7021_trace_entry_t *retrace;
+	size_t count, recount;
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <trace.bin> [retrace.bin]\n", argv[0]);
+		return 2;
+	}
+	if (si7021_replay_load(argv[1]) != SI7021_ERR_OK) {
+		fprintf(stderr, "cannot load trace %s\n", argv[1]);
+		return 2;
+	}
+	original = si7021_replay_entries(&count);
+
+	si7021_trace_enable(true);
+	while ((entry = si7021_replay_peek()) != NULL) {
+		if (entry->op == SI7021_TRACE_OP_DEADLINE) {
+			replay_deadline_call(entry);
+			continue;
+		}
+		if (entry->op != SI7021_TRACE_OP_WRITE) {
+			// the ring wrapped in the middle of a transaction
+			printf("orphan read, skipped\n");
+			si7021_replay_skip();
+			continue;
+		}
+		replay_call(entry);
+	}
+	si7021_trace_enable(false);
+
+	retrace = calloc(SI7021_TRACE_DEPTH, sizeof(si7021_trace_entry_t));
+	if (retrace == NULL) {
+		return 2;
+	}
+	recount = si7021_trace_snapshot(retrace, SI7021_TRACE_DEPTH, NULL);
+	if (argc > 2) {
+		FILE *file = fopen(argv[2], "wb");
+		if (file == NULL || si7021_trace_dump(file) != SI7021_ERR_OK) {
+			fprintf(stderr, "cannot write trace %s\n", argv[2]);
+		}
+		if (file != NULL) {
+			fclose(file);
+		}
+	}
+
+	// skipped orphan and unknown phases are not re-recorded, compare the tails
+	size_t compared = recount < count ? recount : count;
+	bool exact = si7021_replay_divergences() == 0
+			&& memcmp(retrace + recount - compared, original + count - compared,
+					compared * sizeof(si7021_trace_entry_t)) == 0;
+	printf("%zu phases replayed, %u divergences, %s\n", count,
+			si7021_replay_divergences(), exact ? "exact" : "NOT exact");
+	free(retrace);
+	return exact ? 0 : 1;
+}
@@ -0,0 +1,283 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file si7021_replay.c
+ * @brief Linux replay backend for SI7021 Library.
+ *
+ * Each i2c_master_cmd_begin() consumes one recorded bus phase: written bytes are checked
+ * against the trace, read bytes and the error code are taken from it. Virtual time is the
+ * start time of the next recorded phase, so a re-recorded trace matches the original.
+ * Timestamps are 32 bit on target; virtual time is rebuilt from the signed difference between
+ * consecutive bus phases, so it keeps increasing across a wrap. Deadline entries are not bus
+ * phases and never become the current time.
+ */
+
+#include "si7021_replay.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include <string.h>
+
+#define REPLAY_MAX_BYTES		16
+
+typedef struct replay_cmd_t {
+	bool addressed;
+	uint8_t op;
+	size_t len;
+	uint8_t written[REPLAY_MAX_BYTES];
+	uint8_t *read[REPLAY_MAX_BYTES];
+} replay_cmd_t;
+
+static si7021_trace_entry_t *replay_entries = NULL;
+static int64_t *replay_times = NULL;
+static size_t replay_count = 0;
+static size_t replay_next = 0;
+static int64_t replay_last_time = 0;
+static uint32_t replay_divergences = 0;
+
+si7021_err_t si7021_replay_load(const char *path) {
+	si7021_trace_header_t header;
+	FILE *file = fopen(path, "rb");
+	if (file == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	if (fread(&header, sizeof(header), 1, file) != 1
+			|| memcmp(header.magic, SI7021_TRACE_MAGIC, sizeof(header.magic)) != 0
+			|| header.version == 0 || header.version > SI7021_TRACE_VERSION
+			|| header.entry_size != sizeof(si7021_trace_entry_t)) {
+		fclose(file);
+		return SI7021_ERR_INVALID_ARG;
+	}
+	free(replay_entries);
+	free(replay_times);
+	replay_entries = calloc(header.count ? header.count : 1,
+			sizeof(si7021_trace_entry_t));
+	replay_times = calloc(header.count ? header.count : 1, sizeof(int64_t));
+	if (replay_entries == NULL || replay_times == NULL) {
+		fclose(file);
+		return SI7021_ERR_FAIL;
+	}
+	if (fread(replay_entries, sizeof(si7021_trace_entry_t), header.count, file)
+			!= header.count) {
+		fclose(file);
+		return SI7021_ERR_INVALID_ARG;
+	}
+	fclose(file);
+	// a deadline may lie well past the next phases, so only bus phases serve as reference
+	size_t base = 0;
+	for (size_t i = 0; i < header.count; i++) {
+		replay_times[i] = i == 0 ? replay_entries[0].timestamp_us :
+				replay_times[base]
+						+ (int32_t) (replay_entries[i].timestamp_us
+								- replay_entries[base].timestamp_us);
+		if (replay_entries[i].op != SI7021_TRACE_OP_DEADLINE) {
+			base = i;
+		}
+	}
+	replay_count = header.count;
+	replay_next = 0;
+	replay_last_time = 0;
+	replay_divergences = 0;
+	return SI7021_ERR_OK;
+}
+
+const si7021_trace_entry_t *si7021_replay_peek() {
+	if (replay_next >= replay_count) {
+		return NULL;
+	}
+	return &replay_entries[replay_next];
+}
+
+void si7021_replay_skip() {
+	if (replay_next < replay_count) {
+		if (replay_entries[replay_next].op != SI7021_TRACE_OP_DEADLINE) {
+			replay_last_time = replay_times[replay_next];
+		}
+		replay_next++;
+	}
+}
+
+const si7021_trace_entry_t *si7021_replay_entries(size_t *count) {
+	*count = replay_count;
+	return replay_entries;
+}
+
+int64_t si7021_replay_time(const si7021_trace_entry_t *entry) {
+	return replay_times[entry - replay_entries];
+}
+
+uint32_t si7021_replay_divergences() {
+	return replay_divergences;
+}
+
+int64_t esp_timer_get_time(void) {
+	for (size_t i = replay_next; i < replay_count; i++) {
+		if (replay_entries[i].op != SI7021_TRACE_OP_DEADLINE) {
+			return replay_times[i];
+		}
+	}
+	return replay_last_time;
+}
+
+void vTaskDelay(TickType_t ticks) {
+	(void) ticks;
+}
+
+void esp_rom_delay_us(uint32_t us) {
+	(void) us;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth,
+		void *arg, UBaseType_t priority, TaskHandle_t *created) {
+	// callbacks are not replayed, nothing in a trace needs a second task
+	(void) code;
+	(void) name;
+	(void) stack_depth;
+	(void) arg;
+	(void) priority;
+	(void) created;
+	return pdFALSE;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t task) {
+	(void) task;
+	return pdTRUE;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+	(void) clear_on_exit;
+	(void) ticks_to_wait;
+	return 0;
+}
+
+struct host_semaphore_t {
+	pthread_mutex_t mutex;
+};
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) {
+	pthread_mutexattr_t attr;
+	SemaphoreHandle_t semaphore = malloc(sizeof(struct host_semaphore_t));
+	if (semaphore == NULL) {
+		return NULL;
+	}
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&semaphore->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+	return semaphore;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex,
+		TickType_t ticks_to_wait) {
+	// replay is single threaded and time only moves with the trace, so never time out
+	(void) ticks_to_wait;
+	return pthread_mutex_lock(&mutex->mutex) == 0 ? pdTRUE : pdFALSE;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex) {
+	return pthread_mutex_unlock(&mutex->mutex) == 0 ? pdTRUE : pdFALSE;
+}
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t *i2c_conf) {
+	(void) i2c_num;
+	(void) i2c_conf;
+	return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode,
+		size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags) {
+	(void) i2c_num;
+	(void) mode;
+	(void) slv_rx_buf_len;
+	(void) slv_tx_buf_len;
+	(void) intr_alloc_flags;
+	return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void) {
+	return calloc(1, sizeof(replay_cmd_t));
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle) {
+	free(cmd_handle);
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle) {
+	(void) cmd_handle;
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle) {
+	(void) cmd_handle;
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data,
+		bool ack_en) {
+	replay_cmd_t *cmd = cmd_handle;
+	(void) ack_en;
+	if (!cmd->addressed) {
+		cmd->addressed = true;
+		cmd->op = (data & 0x01) ? SI7021_TRACE_OP_READ : SI7021_TRACE_OP_WRITE;
+		return ESP_OK;
+	}
+	if (cmd->len >= REPLAY_MAX_BYTES) {
+		return ESP_ERR_NO_MEM;
+	}
+	cmd->written[cmd->len++] = data;
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd_handle, uint8_t *data,
+		i2c_ack_type_t ack) {
+	replay_cmd_t *cmd = cmd_handle;
+	(void) ack;
+	if (cmd->len >= REPLAY_MAX_BYTES) {
+		return ESP_ERR_NO_MEM;
+	}
+	cmd->read[cmd->len++] = data;
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle,
+		TickType_t ticks_to_wait) {
+	replay_cmd_t *cmd = cmd_handle;
+	const si7021_trace_entry_t *entry = si7021_replay_peek();
+	size_t len = cmd->len < SI7021_TRACE_MAX_DATA ?
+			cmd->len : SI7021_TRACE_MAX_DATA;
+	(void) i2c_num;
+	(void) ticks_to_wait;
+
+	if (entry == NULL) {
+		fprintf(stderr, "replay: trace exhausted\n");
+		replay_divergences++;
+		return ESP_ERR_TIMEOUT;
+	}
+	if (entry->op != cmd->op || entry->len != len
+			|| (cmd->op == SI7021_TRACE_OP_WRITE
+					&& memcmp(entry->data, cmd->written, len) != 0)) {
+		fprintf(stderr, "replay: entry %zu diverged (op %u len %u expected, "
+				"op %u len %zu issued)\n", replay_next, entry->op, entry->len,
+				cmd->op, cmd->len);
+		replay_divergences++;
+	}
+	if (cmd->op == SI7021_TRACE_OP_READ) {
+		for (size_t i = 0; i < len; i++) {
+			*cmd->read[i] = entry->data[i];
+		}
+	}
+	si7021_replay_skip();
+	return entry->err;
+}
@@ -0,0 +1,69 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file si7021_replay.h
+ * @brief Linux replay backend for SI7021 Library.
+ *
+ * Implements the ESP-IDF I2C driver on top of a trace dumped by #si7021_trace_dump(), so si7021.c
+ * can be built on the host and fed the exact bus traffic recorded on a field unit.
+ */
+
+#ifndef HOST_SI7021_REPLAY_H_
+#define HOST_SI7021_REPLAY_H_
+
+#include "si7021.h"
+
+/**
+ * @brief Load a dumped trace, replacing any previously loaded one
+ * @param path Path of the trace file
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG File missing, truncated or not a trace
+ * 		- #SI7021_ERR_FAIL Out of memory
+ */
+si7021_err_t si7021_replay_load(const char *path);
+
+/**
+ * @brief Get the next bus phase that will be replayed
+ * @return Pointer to the entry, NULL when the trace is exhausted
+ */
+const si7021_trace_entry_t *si7021_replay_peek();
+
+/**
+ * @brief Skip the next bus phase without replaying it
+ */
+void si7021_replay_skip();
+
+/**
+ * @brief Get the loaded entries
+ * @param count Receives the number of entries
+ * @return Pointer to the first (oldest) entry
+ */
+const si7021_trace_entry_t *si7021_replay_entries(size_t *count);
+
+/**
+ * @brief Get the time of a loaded entry
+ * @param entry Entry returned by #si7021_replay_peek() or #si7021_replay_entries()
+ * @return Entry time in microseconds, unwrapped from the 32 bit timestamps
+ */
+int64_t si7021_replay_time(const si7021_trace_entry_t *entry);
+
+/**
+ * @brief Number of transactions issued by the driver that did not match the trace
+ */
+uint32_t si7021_replay_divergences();
+
+#endif /* HOST_SI7021_REPLAY_H_ */
@@ -0,0 +1,547 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file si7021_sim.c
+ * @brief Linux simulation backend for SI7021 Library.
+ *
+ * Every simulated thread is either running or waiting for a virtual time or a condition. When
+ * the last running thread starts waiting and no condition is met, the clock jumps to the
+ * earliest wake-up time. All simulation state is guarded by one lock.
+ *
+ * Timeouts are modelled at their worst case: a wait of n ticks lasts n full tick periods.
+ */
+
+#include "si7021_sim.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include <errno.h>
+#include <string.h>
+
+#define SIM_TICK_US				(portTICK_PERIOD_MS * 1000)
+#define SIM_MAX_BYTES			16
+#define SIM_RESET_US			15000
+#define SIM_MAX_TASKS			4
+#define SIM_DEVICE_DEFAULTS		{ .temperature_us = 7000, .humidity_us = 17000, \
+									.raw_temperature = 0x6658, .raw_humidity = 0x7C84, \
+									.byte_us = 25, .stall_from_us = 0, .stall_until_us = 0 }
+
+typedef struct sim_waiter_t {
+	int64_t wake_at;
+	bool (*ready)(void *ctx);
+	void *ctx;
+	struct sim_waiter_t *next;
+} sim_waiter_t;
+
+typedef struct sim_cmd_t {
+	bool addressed;
+	bool reading;
+	size_t len;
+	uint8_t written[SIM_MAX_BYTES];
+	uint8_t *read[SIM_MAX_BYTES];
+} sim_cmd_t;
+
+typedef struct sim_thread_t {
+	void *(*start)(void *);
+	void *arg;
+} sim_thread_t;
+
+struct host_semaphore_t {
+	pthread_t owner;
+	uint32_t count;
+};
+
+typedef struct sim_task_t {
+	TaskFunction_t code;
+	void *arg;
+	uint32_t notifications;
+} sim_task_t;
+
+static pthread_mutex_t sim_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t sim_cond = PTHREAD_COND_INITIALIZER;
+static int64_t sim_now = 0;
+static int sim_running = 1;
+static int sim_joining = 0;
+static sim_waiter_t *sim_waiters = NULL;
+
+static const si7021_sim_device_t sim_defaults = SIM_DEVICE_DEFAULTS;
+static si7021_sim_device_t sim_device = SIM_DEVICE_DEFAULTS;
+static si7021_sim_stats_t sim_stats = { 0 };
+static int64_t sim_busy_until = 0;
+static uint8_t sim_pending = 0;
+static uint16_t sim_result = 0;
+static uint16_t sim_previous_temperature = 0;
+static uint8_t sim_user_reg = 0x3A;
+static uint8_t sim_heater_reg = 0x00;
+static sim_task_t sim_tasks[SIM_MAX_TASKS];
+static size_t sim_task_count = 0;
+static __thread sim_task_t *sim_current_task = NULL;
+
+static bool sim_any_ready() {
+	for (sim_waiter_t *waiter = sim_waiters; waiter != NULL;
+			waiter = waiter->next) {
+		if (sim_now >= waiter->wake_at
+				|| (waiter->ready != NULL && waiter->ready(waiter->ctx))) {
+			return true;
+		}
+	}
+	return false;
+}
+
+// called with sim_lock held, returns with it held
+static void sim_wait(int64_t wake_at, bool (*ready)(void *), void *ctx) {
+	sim_waiter_t self = { wake_at, ready, ctx, sim_waiters };
+	sim_waiters = &self;
+	sim_running--;
+	pthread_cond_broadcast(&sim_cond);
+	while (sim_now < wake_at && (ready == NULL || !ready(ctx))) {
+		if (sim_running == 0 && !sim_any_ready()) {
+			int64_t next = INT64_MAX;
+			for (sim_waiter_t *waiter = sim_waiters; waiter != NULL;
+					waiter = waiter->next) {
+				if (waiter->wake_at < next) {
+					next = waiter->wake_at;
+				}
+			}
+			if (next == INT64_MAX) {
+				if (sim_joining == 0) {
+					fprintf(stderr, "sim: every thread waits forever\n");
+					abort();
+				}
+				// a joined thread has just exited, its joiner runs again
+				pthread_cond_wait(&sim_cond, &sim_lock);
+				continue;
+			}
+			sim_now = next;
+			pthread_cond_broadcast(&sim_cond);
+			continue;
+		}
+		pthread_cond_wait(&sim_cond, &sim_lock);
+	}
+	for (sim_waiter_t **link = &sim_waiters; *link != NULL;
+			link = &(*link)->next) {
+		if (*link == &self) {
+			*link = self.next;
+			break;
+		}
+	}
+	sim_running++;
+}
+
+static uint8_t sim_crc(uint16_t value) {
+	uint8_t crc = 0;
+	uint8_t bytes[2] = { value >> 8, value & 0xFF };
+	for (size_t i = 0; i < sizeof(bytes); i++) {
+		crc ^= bytes[i];
+		for (int bit = 0; bit < 8; bit++) {
+			crc = (crc & 0x80) ? (uint8_t) ((crc << 1) ^ 0x31) : crc << 1;
+		}
+	}
+	return crc;
+}
+
+void si7021_sim_reset() {
+	pthread_mutex_lock(&sim_lock);
+	sim_device = sim_defaults;
+	memset(&sim_stats, 0, sizeof(sim_stats));
+	sim_busy_until = 0;
+	sim_pending = 0;
+	sim_user_reg = 0x3A;
+	sim_heater_reg = 0x00;
+	pthread_mutex_unlock(&sim_lock);
+}
+
+si7021_sim_device_t *si7021_sim_device() {
+	return &sim_device;
+}
+
+void si7021_sim_get_stats(si7021_sim_stats_t *stats) {
+	pthread_mutex_lock(&sim_lock);
+	*stats = sim_stats;
+	pthread_mutex_unlock(&sim_lock);
+}
+
+void si7021_sim_sleep_until(int64_t time_us) {
+	pthread_mutex_lock(&sim_lock);
+	if (time_us > sim_now) {
+		sim_wait(time_us, NULL, NULL);
+	}
+	pthread_mutex_unlock(&sim_lock);
+}
+
+static void *sim_thread_start(void *arg) {
+	sim_thread_t thread = *(sim_thread_t *) arg;
+	void *result;
+	free(arg);
+	result = thread.start(thread.arg);
+	pthread_mutex_lock(&sim_lock);
+	sim_running--;
+	pthread_cond_broadcast(&sim_cond);
+	pthread_mutex_unlock(&sim_lock);
+	return result;
+}
+
+int si7021_sim_thread_create(pthread_t *thread, void *(*start)(void *),
+		void *arg) {
+	int err;
+	sim_thread_t *context = malloc(sizeof(sim_thread_t));
+	if (context == NULL) {
+		return ENOMEM;
+	}
+	context->start = start;
+	context->arg = arg;
+	// counted as running from now on, so the clock waits for it to block
+	pthread_mutex_lock(&sim_lock);
+	sim_running++;
+	pthread_mutex_unlock(&sim_lock);
+	err = pthread_create(thread, NULL, sim_thread_start, context);
+	if (err != 0) {
+		pthread_mutex_lock(&sim_lock);
+		sim_running--;
+		pthread_cond_broadcast(&sim_cond);
+		pthread_mutex_unlock(&sim_lock);
+		free(context);
+	}
+	return err;
+}
+
+int si7021_sim_thread_join(pthread_t thread) {
+	int err;
+	pthread_mutex_lock(&sim_lock);
+	sim_running--;
+	sim_joining++;
+	pthread_cond_broadcast(&sim_cond);
+	pthread_mutex_unlock(&sim_lock);
+	err = pthread_join(thread, NULL);
+	pthread_mutex_lock(&sim_lock);
+	sim_running++;
+	sim_joining--;
+	pthread_mutex_unlock(&sim_lock);
+	return err;
+}
+
+int64_t esp_timer_get_time(void) {
+	int64_t now;
+	pthread_mutex_lock(&sim_lock);
+	now = sim_now;
+	pthread_mutex_unlock(&sim_lock);
+	return now;
+}
+
+void vTaskDelay(TickType_t ticks) {
+	pthread_mutex_lock(&sim_lock);
+	if (ticks > 0) {
+		sim_wait(sim_now + (int64_t) ticks * SIM_TICK_US, NULL, NULL);
+	}
+	pthread_mutex_unlock(&sim_lock);
+}
+
+void esp_rom_delay_us(uint32_t us) {
+	// a busy wait still lets other threads run in the meantime, as on a second core
+	pthread_mutex_lock(&sim_lock);
+	sim_wait(sim_now + us, NULL, NULL);
+	pthread_mutex_unlock(&sim_lock);
+}
+
+static void *sim_task_start(void *arg) {
+	sim_current_task = arg;
+	sim_current_task->code(sim_current_task->arg);
+	return NULL;
+}
+
+BaseType_t xTaskCreate(TaskFunction_t code, const char *name, uint32_t stack_depth,
+		void *arg, UBaseType_t priority, TaskHandle_t *created) {
+	pthread_t thread;
+	sim_task_t *task;
+	pthread_mutex_lock(&sim_lock);
+	if (sim_task_count == SIM_MAX_TASKS) {
+		pthread_mutex_unlock(&sim_lock);
+		return pdFALSE;
+	}
+	task = &sim_tasks[sim_task_count++];
+	task->code = code;
+	task->arg = arg;
+	task->notifications = 0;
+	pthread_mutex_unlock(&sim_lock);
+	// FreeRTOS tasks never return, the thread outlives the test
+	if (si7021_sim_thread_create(&thread, sim_task_start, task) != 0) {
+		return pdFALSE;
+	}
+	pthread_detach(thread);
+	if (created != NULL) {
+		*created = task;
+	}
+	return pdPASS;
+}
+
+BaseType_t xTaskNotifyGive(TaskHandle_t handle) {
+	pthread_mutex_lock(&sim_lock);
+	// tests poll for their own fake task handles, only real tasks are woken
+	for (size_t i = 0; i < sim_task_count; i++) {
+		if (handle == &sim_tasks[i]) {
+			sim_tasks[i].notifications++;
+			pthread_cond_broadcast(&sim_cond);
+		}
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return pdTRUE;
+}
+
+static bool sim_task_notified(void *ctx) {
+	return ((sim_task_t *) ctx)->notifications > 0;
+}
+
+uint32_t ulTaskNotifyTake(BaseType_t clear_on_exit, TickType_t ticks_to_wait) {
+	sim_task_t *task = sim_current_task;
+	uint32_t notifications;
+	pthread_mutex_lock(&sim_lock);
+	if (task->notifications == 0 && ticks_to_wait > 0) {
+		sim_wait(ticks_to_wait == portMAX_DELAY ? INT64_MAX :
+				sim_now + (int64_t) ticks_to_wait * SIM_TICK_US,
+				sim_task_notified, task);
+	}
+	notifications = task->notifications;
+	if (clear_on_exit) {
+		task->notifications = 0;
+	} else if (notifications > 0) {
+		task->notifications--;
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return notifications;
+}
+
+SemaphoreHandle_t xSemaphoreCreateRecursiveMutex(void) {
+	return calloc(1, sizeof(struct host_semaphore_t));
+}
+
+static bool sim_semaphore_free(void *ctx) {
+	return ((SemaphoreHandle_t) ctx)->count == 0;
+}
+
+BaseType_t xSemaphoreTakeRecursive(SemaphoreHandle_t mutex,
+		TickType_t ticks_to_wait) {
+	BaseType_t taken = pdFALSE;
+	pthread_mutex_lock(&sim_lock);
+	if (mutex->count == 0 || !pthread_equal(mutex->owner, pthread_self())) {
+		if (mutex->count != 0 && ticks_to_wait > 0) {
+			sim_wait(ticks_to_wait == portMAX_DELAY ? INT64_MAX :
+					sim_now + (int64_t) ticks_to_wait * SIM_TICK_US,
+					sim_semaphore_free, mutex);
+		}
+		if (mutex->count == 0) {
+			mutex->owner = pthread_self();
+		}
+	}
+	if (pthread_equal(mutex->owner, pthread_self())) {
+		mutex->count++;
+		taken = pdTRUE;
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return taken;
+}
+
+BaseType_t xSemaphoreGiveRecursive(SemaphoreHandle_t mutex) {
+	BaseType_t given = pdFALSE;
+	pthread_mutex_lock(&sim_lock);
+	if (mutex->count > 0 && pthread_equal(mutex->owner, pthread_self())) {
+		if (--mutex->count == 0) {
+			pthread_cond_broadcast(&sim_cond);
+		}
+		given = pdTRUE;
+	}
+	pthread_mutex_unlock(&sim_lock);
+	return given;
+}
+
+esp_err_t i2c_param_config(i2c_port_t i2c_num, const i2c_config_t *i2c_conf) {
+	return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t i2c_num, i2c_mode_t mode,
+		size_t slv_rx_buf_len, size_t slv_tx_buf_len, int intr_alloc_flags) {
+	return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void) {
+	return calloc(1, sizeof(sim_cmd_t));
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd_handle) {
+	free(cmd_handle);
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd_handle) {
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd_handle) {
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd_handle, uint8_t data,
+		bool ack_en) {
+	sim_cmd_t *cmd = cmd_handle;
+	if (!cmd->addressed) {
+		cmd->addressed = true;
+		cmd->reading = (data & 0x01) != 0;
+		return ESP_OK;
+	}
+	if (cmd->len >= SIM_MAX_BYTES) {
+		return ESP_ERR_NO_MEM;
+	}
+	cmd->written[cmd->len++] = data;
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd_handle, uint8_t *data,
+		i2c_ack_type_t ack) {
+	sim_cmd_t *cmd = cmd_handle;
+	if (cmd->len >= SIM_MAX_BYTES) {
+		return ESP_ERR_NO_MEM;
+	}
+	cmd->read[cmd->len++] = data;
+	return ESP_OK;
+}
+
+// called with sim_lock held, the sensor ACKed a write
+static esp_err_t sim_command(const sim_cmd_t *cmd) {
+	uint16_t command = cmd->len >= 2 ?
+			((uint16_t) cmd->written[0] << 8) | cmd->written[1] : 0;
+	if (cmd->len == 0) {
+		return ESP_OK;
+	}
+	sim_pending = cmd->written[0];
+	switch (cmd->written[0]) {
+	case SI7021_MEASTEMP_NOHOLD_CMD:
+		sim_busy_until = sim_now + sim_device.temperature_us;
+		sim_result = sim_device.raw_temperature;
+		sim_stats.conversions++;
+		break;
+	case SI7021_MEASRH_NOHOLD_CMD:
+		sim_busy_until = sim_now + sim_device.humidity_us;
+		sim_result = sim_device.raw_humidity;
+		sim_previous_temperature = sim_device.raw_temperature;
+		sim_stats.conversions++;
+		break;
+	case SI7021_WRITERHT_REG_CMD:
+		if (cmd->len >= 2) {
+			sim_user_reg = cmd->written[1];
+		}
+		sim_pending = 0;
+		break;
+	case SI7021_WRITEHEATER_REG_CMD:
+		if (cmd->len >= 2) {
+			sim_heater_reg = cmd->written[1] & 0xF;
+		}
+		sim_pending = 0;
+		break;
+	case SI7021_SOFT_RESET_CMD:
+		sim_user_reg = 0x3A;
+		sim_heater_reg = 0x00;
+		sim_busy_until = sim_now + SIM_RESET_US;
+		sim_pending = 0;
+		break;
+	case SI7021_READPREVTEMP_CMD:
+	case SI7021_READRHT_REG_CMD:
+	case SI7021_READHEATER_REG_CMD:
+		break;
+	default:
+		if (command == SI7021_ID1_CMD || command == SI7021_ID2_CMD
+				|| command == SI7021_FIRMVERS_CMD) {
+			break;
+		}
+		sim_pending = 0;
+		return ESP_FAIL;
+	}
+	return ESP_OK;
+}
+
+// called with sim_lock held, the sensor ACKed a read
+static esp_err_t sim_response(const sim_cmd_t *cmd) {
+	uint8_t response[SIM_MAX_BYTES] = { 0 };
+	uint16_t value;
+	switch (sim_pending) {
+	case SI7021_MEASTEMP_NOHOLD_CMD:
+	case SI7021_MEASRH_NOHOLD_CMD:
+		value = sim_result;
+		response[0] = value >> 8;
+		response[1] = value & 0xFF;
+		response[2] = sim_crc(value);
+		break;
+	case SI7021_READPREVTEMP_CMD:
+		response[0] = sim_previous_temperature >> 8;
+		response[1] = sim_previous_temperature & 0xFF;
+		break;
+	case SI7021_READRHT_REG_CMD:
+		response[0] = sim_user_reg;
+		break;
+	case SI7021_READHEATER_REG_CMD:
+		response[0] = sim_heater_reg;
+		break;
+	case SI7021_FIRMVERS_CMD >> 8:
+		response[0] = 0x20;
+		break;
+	case SI7021_ID1_CMD >> 8:
+	case SI7021_ID2_CMD >> 8:
+		memset(response, 0x15, sizeof(response));
+		break;
+	default:
+		// nothing to read back, the sensor does not acknowledge its address
+		return ESP_FAIL;
+	}
+	sim_pending = 0;
+	for (size_t i = 0; i < cmd->len; i++) {
+		*cmd->read[i] = response[i];
+	}
+	return ESP_OK;
+}
+
+esp_err_t i2c_master_cmd_begin(i2c_port_t i2c_num, i2c_cmd_handle_t cmd_handle,
+		TickType_t ticks_to_wait) {
+	sim_cmd_t *cmd = cmd_handle;
+	esp_err_t err;
+	int64_t start, timeout_at;
+
+	pthread_mutex_lock(&sim_lock);
+	start = sim_now;
+	timeout_at = ticks_to_wait == portMAX_DELAY ? INT64_MAX :
+			sim_now + (int64_t) ticks_to_wait * SIM_TICK_US;
+	sim_stats.transactions++;
+	if (sim_device.stall_from_us <= sim_now
+			&& sim_device.stall_until_us > sim_now) {
+		// SCL held low: the transaction ends when the stall does or the driver gives up
+		if (sim_device.stall_until_us >= timeout_at) {
+			sim_wait(timeout_at, NULL, NULL);
+			sim_stats.timeouts++;
+			sim_stats.bus_us += sim_now - start;
+			pthread_mutex_unlock(&sim_lock);
+			return ESP_ERR_TIMEOUT;
+		}
+		sim_wait(sim_device.stall_until_us, NULL, NULL);
+	}
+	if (sim_now < sim_busy_until) {
+		// only the address byte goes out before the NACK
+		sim_wait(sim_now + sim_device.byte_us, NULL, NULL);
+		sim_stats.nacks++;
+		err = ESP_FAIL;
+	} else {
+		sim_wait(sim_now + (int64_t) (cmd->len + 1) * sim_device.byte_us, NULL,
+				NULL);
+		err = cmd->reading ? sim_response(cmd) : sim_command(cmd);
+	}
+	sim_stats.bus_us += sim_now - start;
+	pthread_mutex_unlock(&sim_lock);
+	return err;
+}
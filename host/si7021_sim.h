@@ -0,0 +1,102 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file si7021_sim.h
+ * @brief Linux simulation backend for SI7021 Library.
+ *
+ * Implements the ESP-IDF I2C driver and the FreeRTOS calls used by si7021.c on top of a
+ * simulated sensor and a virtual clock, so timing behaviour can be tested on the host.
+ *
+ * Threads started with #si7021_sim_thread_create() run on real pthreads, but virtual time
+ * only advances once every one of them (and the main thread) is blocked in vTaskDelay(), a
+ * bus transaction, a mutex wait or ulTaskNotifyTake(). Results therefore do not depend on host
+ * load. Tasks created with xTaskCreate() are such threads and never end.
+ */
+
+#ifndef HOST_SI7021_SIM_H_
+#define HOST_SI7021_SIM_H_
+
+#include "si7021.h"
+#include <pthread.h>
+
+/**
+ * @brief Simulated sensor behaviour, see #si7021_sim_device()
+ */
+typedef struct si7021_sim_device_t {
+	uint32_t temperature_us;			/*!< Temperature conversion time */
+	uint32_t humidity_us;				/*!< RH (and temperature) conversion time */
+	uint16_t raw_temperature;			/*!< Raw temperature returned by measurements */
+	uint16_t raw_humidity;				/*!< Raw humidity returned by measurements */
+	uint32_t byte_us;					/*!< Bus time per byte, address included */
+	int64_t stall_from_us;				/*!< SCL held low from this time... */
+	int64_t stall_until_us;				/*!< ...until this time, 0 for no stall */
+} si7021_sim_device_t;
+
+/**
+ * @brief Simulated sensor counters, see #si7021_sim_get_stats()
+ */
+typedef struct si7021_sim_stats_t {
+	uint32_t conversions;				/*!< Measurements started */
+	uint32_t transactions;				/*!< Bus transactions, failed ones included */
+	uint32_t nacks;						/*!< Transactions NACKed during a conversion */
+	uint32_t timeouts;					/*!< Transactions that timed out on a stall */
+	int64_t bus_us;						/*!< Bus time spent in transactions */
+} si7021_sim_stats_t;
+
+/**
+ * @brief Restore the default sensor behaviour and registers and clear the counters
+ *
+ * The virtual clock keeps running. Defaults: typical conversion times (7 ms temperature,
+ * 17 ms RH), 23.4 °C and 54.8 %RH, 25 us per byte (400 kHz), no stall.
+ */
+void si7021_sim_reset();
+
+/**
+ * @brief Get the simulated sensor behaviour
+ * @return Pointer to the behaviour, only change it while no simulated thread uses the bus
+ */
+si7021_sim_device_t *si7021_sim_device();
+
+/**
+ * @brief Get the simulated sensor counters
+ * @param stats Receives the counters
+ */
+void si7021_sim_get_stats(si7021_sim_stats_t *stats);
+
+/**
+ * @brief Block the calling thread until a virtual time
+ * @param time_us Virtual time in microseconds, as returned by esp_timer_get_time()
+ */
+void si7021_sim_sleep_until(int64_t time_us);
+
+/**
+ * @brief Start a thread that takes part in virtual time
+ * @param thread Receives the thread handle
+ * @param start Thread function
+ * @param arg Argument of the thread function
+ * @return 0 on success, an errno value otherwise
+ */
+int si7021_sim_thread_create(pthread_t *thread, void *(*start)(void *),
+		void *arg);
+
+/**
+ * @brief Wait for a thread started with #si7021_sim_thread_create()
+ * @param thread Thread handle
+ * @return 0 on success, an errno value otherwise
+ */
+int si7021_sim_thread_join(pthread_t thread);
+
+#endif /* HOST_SI7021_SIM_H_ */
@@ -0,0 +1,50 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file test.h
+ * @brief Minimal assertions for the host tests of SI7021 Library.
+ */
+
+#ifndef HOST_TEST_TEST_H_
+#define HOST_TEST_TEST_H_
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#define TEST_ASSERT(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: assertion failed: %s\n", __FILE__, __LINE__, \
+				#cond); \
+		exit(1); \
+	} \
+} while (0)
+
+#define TEST_ASSERT_EQ(expected, actual) do { \
+	long long __expected = (long long) (expected); \
+	long long __actual = (long long) (actual); \
+	if (__expected != __actual) { \
+		fprintf(stderr, "%s:%d: %s == %s failed: %lld != %lld\n", __FILE__, \
+				__LINE__, #expected, #actual, __expected, __actual); \
+		exit(1); \
+	} \
+} while (0)
+
+#define RUN_TEST(test) do { \
+	test(); \
+	printf("%s: ok\n", #test); \
+} while (0)
+
+#endif /* HOST_TEST_TEST_H_ */
@@ -0,0 +1,173 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file test_cache.c
+ * @brief Concurrent cached reads against the simulated sensor.
+ *
+ * Threads start together in virtual time, so every window is deterministic: the first caller
+ * converts and every caller that found the cache stale while it held the bus coalesces.
+ */
+
+#include "si7021_sim.h"
+#include "esp_timer.h"
+#include "test.h"
+
+#define THREADS			8
+#define MAX_AGE_US		100000
+
+typedef enum {
+	CALL_TEMPERATURE, CALL_PAIR
+} call_t;
+
+typedef struct worker_t {
+	pthread_t thread;
+	call_t call;
+	float temperature;
+	float humidity;
+	si7021_err_t err;
+} worker_t;
+
+static float expected_temperature;
+static float expected_humidity;
+
+static void *worker(void *arg) {
+	worker_t *self = arg;
+	if (self->call == CALL_TEMPERATURE) {
+		self->temperature = si7021_read_temperature_cached(MAX_AGE_US);
+		self->err = self->temperature == -999 ? SI7021_ERR_FAIL : SI7021_ERR_OK;
+	} else {
+		self->err = si7021_read_pair_cached(MAX_AGE_US, &self->temperature,
+				&self->humidity);
+	}
+	return NULL;
+}
+
+// runs one window of concurrent calls, returns the conversions it cost
+static uint32_t run_window(const call_t *calls, si7021_cache_stats_t *stats) {
+	worker_t workers[THREADS];
+	si7021_sim_stats_t before, after;
+
+	si7021_reset_cache_stats();
+	si7021_sim_get_stats(&before);
+	for (int i = 0; i < THREADS; i++) {
+		workers[i].call = calls[i];
+		TEST_ASSERT_EQ(0,
+				si7021_sim_thread_create(&workers[i].thread, worker, &workers[i]));
+	}
+	for (int i = 0; i < THREADS; i++) {
+		TEST_ASSERT_EQ(0, si7021_sim_thread_join(workers[i].thread));
+		TEST_ASSERT_EQ(SI7021_ERR_OK, workers[i].err);
+		TEST_ASSERT(workers[i].temperature == expected_temperature);
+		if (workers[i].call == CALL_PAIR) {
+			TEST_ASSERT(workers[i].humidity == expected_humidity);
+		}
+	}
+	si7021_sim_get_stats(&after);
+	si7021_get_cache_stats(stats);
+	// every call is accounted for exactly once
+	TEST_ASSERT_EQ(THREADS, stats->hits + stats->misses + stats->coalesced);
+	return after.conversions - before.conversions;
+}
+
+static void expire_cache() {
+	si7021_sim_sleep_until(esp_timer_get_time() + 2 * MAX_AGE_US);
+}
+
+static void test_temperature_window() {
+	call_t calls[THREADS];
+	si7021_cache_stats_t stats;
+	for (int i = 0; i < THREADS; i++) {
+		calls[i] = CALL_TEMPERATURE;
+	}
+	expire_cache();
+	TEST_ASSERT_EQ(1, run_window(calls, &stats));
+	TEST_ASSERT_EQ(0, stats.hits);
+	TEST_ASSERT_EQ(1, stats.misses);
+	TEST_ASSERT_EQ(THREADS - 1, stats.coalesced);
+
+	// still fresh: served without touching the bus
+	TEST_ASSERT_EQ(0, run_window(calls, &stats));
+	TEST_ASSERT_EQ(THREADS, stats.hits);
+}
+
+static void test_pair_window() {
+	call_t calls[THREADS];
+	si7021_cache_stats_t stats;
+	for (int i = 0; i < THREADS; i++) {
+		calls[i] = CALL_PAIR;
+	}
+	expire_cache();
+	TEST_ASSERT_EQ(1, run_window(calls, &stats));
+	TEST_ASSERT_EQ(0, stats.hits);
+	TEST_ASSERT_EQ(1, stats.misses);
+	TEST_ASSERT_EQ(THREADS - 1, stats.coalesced);
+
+	TEST_ASSERT_EQ(0, run_window(calls, &stats));
+	TEST_ASSERT_EQ(THREADS, stats.hits);
+}
+
+static void test_mixed_windows() {
+	call_t calls[THREADS];
+	si7021_cache_stats_t stats;
+	for (int i = 0; i < THREADS; i++) {
+		calls[i] = (i & 1) ? CALL_PAIR : CALL_TEMPERATURE;
+	}
+	for (int window = 0; window < 5; window++) {
+		expire_cache();
+		uint32_t conversions = run_window(calls, &stats);
+		// a pair refreshes both quantities, a temperature measurement only one
+		TEST_ASSERT(conversions == 1 || conversions == 2);
+		TEST_ASSERT_EQ(conversions, stats.misses);
+		TEST_ASSERT_EQ(0, stats.hits);
+	}
+	// right after a window both quantities are fresh for everybody
+	TEST_ASSERT_EQ(0, run_window(calls, &stats));
+	TEST_ASSERT_EQ(THREADS, stats.hits);
+}
+
+static void test_producer_not_counted() {
+	call_t calls[THREADS];
+	si7021_cache_stats_t stats;
+	for (int i = 0; i < THREADS; i++) {
+		calls[i] = CALL_PAIR;
+	}
+	expire_cache();
+	si7021_reset_cache_stats();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_sample_produce());
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_sample_produce());
+	si7021_get_cache_stats(&stats);
+	TEST_ASSERT_EQ(0, stats.hits + stats.misses + stats.coalesced);
+
+	// the produced sample still refreshed the cache for user calls
+	TEST_ASSERT_EQ(0, run_window(calls, &stats));
+	TEST_ASSERT_EQ(THREADS, stats.hits);
+}
+
+int main() {
+	si7021_config_t config = { 0 };
+	si7021_sim_reset();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_init(&config));
+	expected_temperature = __si7021_raw_to_temperature(
+			si7021_sim_device()->raw_temperature);
+	expected_humidity = __si7021_raw_to_humidity(
+			si7021_sim_device()->raw_humidity);
+
+	RUN_TEST(test_temperature_window);
+	RUN_TEST(test_pair_window);
+	RUN_TEST(test_mixed_windows);
+	RUN_TEST(test_producer_not_counted);
+	return 0;
+}
@@ -0,0 +1,248 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file test_deadline.c
+ * @brief Deadline reads against slow, NACKing and stalling simulated sensors.
+ *
+ * The host tick is 10 ms (100 Hz) and the simulator lets every tick based wait run to its
+ * worst case, so a call that returns by its deadline here does so on target too.
+ *
+ * Usage: test_deadline [trace.bin] dumps the single threaded cases for si7021_replay.
+ */
+
+#include "si7021_sim.h"
+#include "esp_timer.h"
+#include "test.h"
+
+#define TICK_US			(portTICK_PERIOD_MS * 1000)
+#define BUDGET_US		20000
+
+typedef struct result_t {
+	si7021_err_t err;
+	float value;
+	int64_t start_us;
+	int64_t deadline_us;
+	int64_t end_us;
+	si7021_sim_stats_t sim;
+} result_t;
+
+static float expected_temperature;
+
+// gives the previous test's conversions and stalls time to end
+static void fresh_sensor() {
+	si7021_sim_sleep_until(esp_timer_get_time() + 100000);
+	si7021_sim_reset();
+}
+
+static result_t read_temperature(uint32_t budget_us) {
+	result_t result = { .value = -999 };
+	result.start_us = esp_timer_get_time();
+	result.deadline_us = result.start_us + budget_us;
+	result.err = si7021_read_temperature_deadline(result.deadline_us,
+			&result.value);
+	result.end_us = esp_timer_get_time();
+	si7021_sim_get_stats(&result.sim);
+	TEST_ASSERT(result.end_us <= result.deadline_us);
+	return result;
+}
+
+static result_t read_humidity(uint32_t budget_us) {
+	result_t result = { .value = -999 };
+	result.start_us = esp_timer_get_time();
+	result.deadline_us = result.start_us + budget_us;
+	result.err = si7021_read_humidity_deadline(result.deadline_us,
+			&result.value);
+	result.end_us = esp_timer_get_time();
+	si7021_sim_get_stats(&result.sim);
+	TEST_ASSERT(result.end_us <= result.deadline_us);
+	return result;
+}
+
+static void test_typical_conversion() {
+	fresh_sensor();
+	result_t result = read_temperature(BUDGET_US);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, result.err);
+	TEST_ASSERT(result.value == expected_temperature);
+	// first poll lands right after the typical conversion
+	TEST_ASSERT_EQ(0, result.sim.nacks);
+	TEST_ASSERT_EQ(2, result.sim.transactions);
+	TEST_ASSERT(result.end_us - result.start_us < 8000);
+}
+
+static void test_slow_conversion_polls_at_interval() {
+	fresh_sensor();
+	si7021_sim_device()->temperature_us = 8800;
+	result_t result = read_temperature(BUDGET_US);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, result.err);
+	// polls after 7 and 8 ms of conversion are NACKed, the one after 9 ms answers
+	TEST_ASSERT_EQ(2, result.sim.nacks);
+	TEST_ASSERT(result.end_us - result.start_us < 9500);
+}
+
+static void test_slow_device_misses_deadline() {
+	fresh_sensor();
+	si7021_sim_device()->temperature_us = 30000;
+	result_t result = read_temperature(BUDGET_US);
+	TEST_ASSERT_EQ(SI7021_ERR_DEADLINE, result.err);
+	TEST_ASSERT(result.value == -999);
+	// one poll per millisecond while a tick long transaction still fits, no spinning
+	TEST_ASSERT(result.sim.nacks <= (BUDGET_US - TICK_US - 7000) / 1000 + 1);
+}
+
+static void test_stalled_command() {
+	fresh_sensor();
+	si7021_sim_device()->stall_until_us = esp_timer_get_time() + 1000000;
+	result_t result = read_temperature(BUDGET_US);
+	TEST_ASSERT_EQ(SI7021_ERR_DEADLINE, result.err);
+	TEST_ASSERT_EQ(1, result.sim.timeouts);
+}
+
+static void test_stalled_poll() {
+	fresh_sensor();
+	int64_t now = esp_timer_get_time();
+	si7021_sim_device()->stall_from_us = now + 5000;
+	si7021_sim_device()->stall_until_us = now + 1000000;
+	result_t result = read_temperature(BUDGET_US);
+	TEST_ASSERT_EQ(SI7021_ERR_DEADLINE, result.err);
+	TEST_ASSERT_EQ(1, result.sim.timeouts);
+	// the poll after 7 ms of conversion may only wait the one whole tick left
+	TEST_ASSERT(result.end_us - result.start_us > 7000 + TICK_US);
+}
+
+static void test_tight_budget_fails_fast() {
+	fresh_sensor();
+	// a typical conversion and a tick long poll do not fit in 15 ms
+	result_t result = read_temperature(15000);
+	TEST_ASSERT_EQ(SI7021_ERR_DEADLINE, result.err);
+	TEST_ASSERT_EQ(0, result.sim.transactions);
+	TEST_ASSERT_EQ(result.start_us, result.end_us);
+
+	result = read_humidity(BUDGET_US);
+	TEST_ASSERT_EQ(SI7021_ERR_DEADLINE, result.err);
+	TEST_ASSERT_EQ(0, result.sim.transactions);
+
+	result = read_humidity(30000);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, result.err);
+}
+
+static void test_recovers_after_abandoned_conversion() {
+	fresh_sensor();
+	si7021_sim_device()->temperature_us = 10500;
+	result_t result = read_temperature(18000);
+	TEST_ASSERT_EQ(SI7021_ERR_DEADLINE, result.err);
+	TEST_ASSERT_EQ(1, result.sim.conversions);
+
+	// the next command waits for the abandoned conversion, a NACKed command would fail
+	result = read_temperature(40000);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, result.err);
+	TEST_ASSERT_EQ(2, result.sim.conversions);
+}
+
+// leaves the sensor converting, NACKing commands, for up to a millisecond after the call
+static uint32_t abandon_conversion() {
+	si7021_sim_stats_t stats;
+	si7021_sim_device()->temperature_us = 10500;
+	TEST_ASSERT_EQ(SI7021_ERR_DEADLINE, read_temperature(18000).err);
+	si7021_sim_device()->temperature_us = 7000;
+	si7021_sim_get_stats(&stats);
+	return stats.nacks;
+}
+
+static uint32_t nacks() {
+	si7021_sim_stats_t stats;
+	si7021_sim_get_stats(&stats);
+	return stats.nacks;
+}
+
+static void test_register_commands_wait_for_abandoned_conversion() {
+	uint32_t before;
+	fresh_sensor();
+
+	before = abandon_conversion();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_set_heater_register(0x3));
+	TEST_ASSERT_EQ(before, nacks());
+
+	before = abandon_conversion();
+	TEST_ASSERT_EQ(0x3, si7021_get_heater_register());
+	TEST_ASSERT_EQ(before, nacks());
+
+	// a NACKed register read must not turn into a write of the wrong bits
+	before = abandon_conversion();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_set_heater_status(SI7021_HEATER_ON));
+	TEST_ASSERT_EQ(before, nacks());
+	TEST_ASSERT_EQ(0x3E, __si7021_read_user_register());
+
+	before = abandon_conversion();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_set_heater_status(SI7021_HEATER_OFF));
+	before = abandon_conversion();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_check_availability());
+	TEST_ASSERT_EQ(before, nacks());
+}
+
+static void *blocking_reader(void *arg) {
+	*(float *) arg = si7021_read_temperature();
+	return NULL;
+}
+
+static void test_bus_contention() {
+	pthread_t thread;
+	float blocking_value;
+	fresh_sensor();
+	// a plain read holds the bus for its fixed 50 ms wait
+	TEST_ASSERT_EQ(0,
+			si7021_sim_thread_create(&thread, blocking_reader, &blocking_value));
+	si7021_sim_sleep_until(esp_timer_get_time() + 1000);
+
+	// no whole tick to wait for the bus: plain try
+	result_t result = read_temperature(BUDGET_US);
+	TEST_ASSERT_EQ(SI7021_ERR_DEADLINE, result.err);
+	TEST_ASSERT_EQ(result.start_us, result.end_us);
+
+	// two ticks of waiting fit before the command must start
+	result = read_temperature(40000);
+	TEST_ASSERT_EQ(SI7021_ERR_DEADLINE, result.err);
+	TEST_ASSERT_EQ(result.start_us + 2 * TICK_US, result.end_us);
+
+	TEST_ASSERT_EQ(0, si7021_sim_thread_join(thread));
+	TEST_ASSERT(blocking_value == expected_temperature);
+}
+
+int main(int argc, char **argv) {
+	si7021_config_t config = { 0 };
+	si7021_sim_reset();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_init(&config));
+	expected_temperature = __si7021_raw_to_temperature(
+			si7021_sim_device()->raw_temperature);
+
+	si7021_trace_enable(true);
+	RUN_TEST(test_typical_conversion);
+	RUN_TEST(test_slow_conversion_polls_at_interval);
+	RUN_TEST(test_slow_device_misses_deadline);
+	RUN_TEST(test_stalled_command);
+	RUN_TEST(test_stalled_poll);
+	RUN_TEST(test_tight_budget_fails_fast);
+	RUN_TEST(test_recovers_after_abandoned_conversion);
+	si7021_trace_enable(false);
+	if (argc > 1) {
+		FILE *file = fopen(argv[1], "wb");
+		TEST_ASSERT(file != NULL);
+		TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_trace_dump(file));
+		fclose(file);
+	}
+	RUN_TEST(test_bus_contention);
+	RUN_TEST(test_register_commands_wait_for_abandoned_conversion);
+	return 0;
+}
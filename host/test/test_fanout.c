@@ -0,0 +1,260 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file test_fanout.c
+ * @brief Sample fan-out to task and callback subscribers against the simulated sensor.
+ */
+
+#include "si7021_sim.h"
+#include "esp_timer.h"
+#include "esp_rom_sys.h"
+#include "test.h"
+
+#define DIVIDER			3
+#define CALLBACK_MAX	16
+
+typedef struct callback_log_t {
+	uint32_t count;
+	uint32_t sequence[CALLBACK_MAX];
+	uint32_t sleep_ms;
+} callback_log_t;
+
+static int task_token;
+static volatile bool reader_stop;
+
+static void sleep_ms(uint32_t ms) {
+	si7021_sim_sleep_until(esp_timer_get_time() + (int64_t) ms * 1000);
+}
+
+static void log_callback(const si7021_sample_t *sample, void *arg) {
+	callback_log_t *log = arg;
+	if (log->count < CALLBACK_MAX) {
+		log->sequence[log->count] = sample->sequence;
+	}
+	log->count++;
+	if (log->sleep_ms > 0) {
+		sleep_ms(log->sleep_ms);
+	}
+}
+
+// a periodic producer, the period lets the dispatcher and readers run
+static void produce() {
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_sample_produce());
+	sleep_ms(1);
+}
+
+static uint32_t latest_sequence() {
+	si7021_sample_t sample;
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_sample_latest(&sample));
+	return sample.sequence;
+}
+
+static void produce_and_read(si7021_subscriber_t subscriber, bool read) {
+	si7021_sample_t sample;
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_sample_produce());
+	if (read) {
+		TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_subscriber_read(subscriber, &sample));
+	}
+}
+
+static void test_divider_reads_are_not_drops() {
+	si7021_subscriber_t subscriber;
+	si7021_subscriber_stats_t stats;
+	TEST_ASSERT_EQ(SI7021_ERR_OK,
+			si7021_subscribe_task(&task_token, DIVIDER, &subscriber));
+
+	// a task polling every sample reads samples the divider skipped too
+	for (int i = 0; i < 4 * DIVIDER; i++) {
+		produce_and_read(subscriber, true);
+	}
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_get_subscriber_stats(subscriber, &stats));
+	TEST_ASSERT_EQ(4, stats.delivered);
+	TEST_ASSERT_EQ(0, stats.dropped);
+	TEST_ASSERT_EQ(0, stats.lag);
+	si7021_unsubscribe(subscriber);
+}
+
+static void test_unread_notification_is_a_drop() {
+	si7021_subscriber_t subscriber;
+	si7021_subscriber_stats_t stats;
+	TEST_ASSERT_EQ(SI7021_ERR_OK,
+			si7021_subscribe_task(&task_token, DIVIDER, &subscriber));
+
+	produce_and_read(subscriber, true);
+	for (int i = 1; i < DIVIDER; i++) {
+		produce_and_read(subscriber, false);
+	}
+	// second notification: the first one was read, nothing lost yet
+	produce_and_read(subscriber, false);
+	for (int i = 1; i < DIVIDER; i++) {
+		produce_and_read(subscriber, false);
+	}
+	// third notification: the second one was never read
+	produce_and_read(subscriber, false);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_get_subscriber_stats(subscriber, &stats));
+	TEST_ASSERT_EQ(3, stats.delivered);
+	TEST_ASSERT_EQ(1, stats.dropped);
+	TEST_ASSERT_EQ(2 * DIVIDER, stats.lag);
+	si7021_unsubscribe(subscriber);
+}
+
+static void test_callback_divider() {
+	si7021_subscriber_t subscriber;
+	si7021_subscriber_stats_t stats;
+	callback_log_t log = { 0 };
+	TEST_ASSERT_EQ(SI7021_ERR_OK,
+			si7021_subscribe_callback(log_callback, &log, DIVIDER, &subscriber));
+
+	for (int i = 0; i < 3 * DIVIDER; i++) {
+		produce();
+	}
+	TEST_ASSERT_EQ(3, log.count);
+	TEST_ASSERT_EQ(log.sequence[0] + DIVIDER, log.sequence[1]);
+	TEST_ASSERT_EQ(log.sequence[1] + DIVIDER, log.sequence[2]);
+	TEST_ASSERT_EQ(latest_sequence() - DIVIDER + 1, log.sequence[2]);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_get_subscriber_stats(subscriber, &stats));
+	TEST_ASSERT_EQ(3, stats.delivered);
+	TEST_ASSERT_EQ(0, stats.dropped);
+	si7021_unsubscribe(subscriber);
+}
+
+static void test_slow_callback_does_not_stall_producer() {
+	si7021_subscriber_t slow_subscriber, subscriber;
+	si7021_subscriber_stats_t stats;
+	callback_log_t slow = { .sleep_ms = 500 }, log = { 0 };
+	int64_t start;
+	TEST_ASSERT_EQ(SI7021_ERR_OK,
+			si7021_subscribe_callback(log_callback, &slow, 1, &slow_subscriber));
+	TEST_ASSERT_EQ(SI7021_ERR_OK,
+			si7021_subscribe_callback(log_callback, &log, 1, &subscriber));
+
+	// each produce only waits for its own measurement, not for the callback's 500 ms
+	for (int i = 0; i < 3; i++) {
+		start = esp_timer_get_time();
+		produce();
+		TEST_ASSERT(esp_timer_get_time() - start < 100000);
+	}
+	TEST_ASSERT_EQ(1, slow.count);
+	TEST_ASSERT_EQ(0, log.count);
+
+	// the first delivery was being dispatched, the second was overwritten by the third
+	TEST_ASSERT_EQ(SI7021_ERR_OK,
+			si7021_get_subscriber_stats(slow_subscriber, &stats));
+	TEST_ASSERT_EQ(3, stats.delivered);
+	TEST_ASSERT_EQ(1, stats.dropped);
+	sleep_ms(2 * slow.sleep_ms);
+	TEST_ASSERT_EQ(2, slow.count);
+	TEST_ASSERT_EQ(latest_sequence(), slow.sequence[1]);
+	TEST_ASSERT(log.count >= 1);
+	TEST_ASSERT_EQ(latest_sequence(), log.sequence[log.count - 1]);
+	si7021_unsubscribe(slow_subscriber);
+	si7021_unsubscribe(subscriber);
+}
+
+static void test_unsubscribed_callback_is_not_called() {
+	si7021_subscriber_t subscriber;
+	si7021_subscriber_stats_t stats;
+	callback_log_t log = { 0 };
+	TEST_ASSERT_EQ(SI7021_ERR_OK,
+			si7021_subscribe_callback(log_callback, &log, 1, &subscriber));
+	produce();
+	TEST_ASSERT_EQ(1, log.count);
+
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_unsubscribe(subscriber));
+	produce();
+	TEST_ASSERT_EQ(1, log.count);
+	TEST_ASSERT_EQ(SI7021_ERR_INVALID_STATE,
+			si7021_get_subscriber_stats(subscriber, &stats));
+	TEST_ASSERT_EQ(SI7021_ERR_INVALID_ARG,
+			si7021_unsubscribe(SI7021_MAX_SUBSCRIBERS));
+}
+
+static void test_full_table() {
+	si7021_subscriber_t subscribers[SI7021_MAX_SUBSCRIBERS], extra;
+	callback_log_t log = { 0 };
+	for (int i = 0; i < SI7021_MAX_SUBSCRIBERS; i++) {
+		TEST_ASSERT_EQ(SI7021_ERR_OK,
+				i % 2 ? si7021_subscribe_task(&task_token, 1, &subscribers[i]) :
+						si7021_subscribe_callback(log_callback, &log, 1,
+								&subscribers[i]));
+	}
+	TEST_ASSERT_EQ(SI7021_ERR_FAIL,
+			si7021_subscribe_callback(log_callback, &log, 1, &extra));
+	TEST_ASSERT_EQ(SI7021_ERR_FAIL, si7021_subscribe_task(&task_token, 1, &extra));
+
+	// a freed slot is reused
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_unsubscribe(subscribers[3]));
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_subscribe_task(&task_token, 1, &extra));
+	TEST_ASSERT_EQ(subscribers[3], extra);
+	for (int i = 0; i < SI7021_MAX_SUBSCRIBERS; i++) {
+		TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_unsubscribe(subscribers[i]));
+	}
+}
+
+static float humidity_of(uint32_t sequence, uint32_t first_sequence) {
+	return __si7021_raw_to_humidity(
+			0x7C84 + ((sequence - first_sequence) << 2));
+}
+
+static void *seqlock_reader(void *arg) {
+	uint32_t first_sequence = *(uint32_t *) arg, reads = 0;
+	si7021_sample_t sample;
+	while (!reader_stop) {
+		for (int i = 0; i < 1000; i++) {
+			TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_sample_latest(&sample));
+			if ((int32_t) (sample.sequence - first_sequence) < 0) {
+				continue;
+			}
+			// every field comes from the same publish
+			TEST_ASSERT(sample.humidity == humidity_of(sample.sequence, first_sequence));
+			reads++;
+		}
+		// lets the virtual clock move on
+		esp_rom_delay_us(100);
+	}
+	TEST_ASSERT(reads > 0);
+	return NULL;
+}
+
+static void test_reader_against_seqlock() {
+	pthread_t thread;
+	uint32_t first_sequence = latest_sequence() + 1;
+	reader_stop = false;
+	TEST_ASSERT_EQ(0,
+			si7021_sim_thread_create(&thread, seqlock_reader, &first_sequence));
+	for (uint32_t i = 0; i < 64; i++) {
+		si7021_sim_device()->raw_humidity = 0x7C84 + (i << 2);
+		produce();
+	}
+	reader_stop = true;
+	TEST_ASSERT_EQ(0, si7021_sim_thread_join(thread));
+	si7021_sim_reset();
+}
+
+int main() {
+	si7021_config_t config = { 0 };
+	si7021_sim_reset();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_init(&config));
+
+	RUN_TEST(test_divider_reads_are_not_drops);
+	RUN_TEST(test_unread_notification_is_a_drop);
+	RUN_TEST(test_callback_divider);
+	RUN_TEST(test_slow_callback_does_not_stall_producer);
+	RUN_TEST(test_unsubscribed_callback_is_not_called);
+	RUN_TEST(test_full_table);
+	RUN_TEST(test_reader_against_seqlock);
+	return 0;
+}
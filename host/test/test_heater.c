@@ -0,0 +1,216 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file test_heater.c
+ * @brief Heater controller against the simulated sensor.
+ */
+
+#include "si7021_sim.h"
+#include "esp_timer.h"
+#include "test.h"
+#include <math.h>
+#include <stdlib.h>
+
+static float expected_temperature;
+
+static void sleep_ms(uint32_t ms) {
+	si7021_sim_sleep_until(esp_timer_get_time() + (int64_t) ms * 1000);
+}
+
+static si7021_sample_t produce() {
+	si7021_sample_t sample;
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_sample_produce());
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_sample_latest(&sample));
+	return sample;
+}
+
+static void test_manual_heater_without_controller() {
+	si7021_heater_stats_t stats;
+	// no si7021_heater_start() yet, so no policy excludes the warm samples
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_set_heater_status(SI7021_HEATER_ON));
+	for (int i = 0; i < 3; i++) {
+		si7021_sample_t sample = produce();
+		TEST_ASSERT(!sample.compensated);
+		TEST_ASSERT(sample.temperature == expected_temperature);
+	}
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_set_heater_status(SI7021_HEATER_OFF));
+	si7021_get_heater_stats(&stats);
+	TEST_ASSERT_EQ(0, stats.samples);
+	TEST_ASSERT_EQ(0, stats.samples_excluded);
+	TEST_ASSERT_EQ(0, stats.samples_compensated);
+}
+
+static void test_heater_register_read_refreshes_shadow() {
+	si7021_sim_stats_t before, after;
+	si7021_heater_config_t config = { .current = 0x0, .period_ms = 1000,
+			.on_ms = 0, .policy = SI7021_HEATER_EXCLUDE };
+	TEST_ASSERT_EQ(0x0, si7021_get_heater_register());
+
+	// the current is known from the read, nothing to write
+	si7021_sim_get_stats(&before);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_heater_start(&config));
+	si7021_sim_get_stats(&after);
+	TEST_ASSERT_EQ(before.transactions, after.transactions);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_heater_stop());
+}
+
+static void test_manual_toggle_tracked() {
+	si7021_sample_t sample;
+	// on_ms = 0: the controller itself never switches the heater on
+	si7021_heater_config_t config = { .current = 0x4, .period_ms = 1000,
+			.on_ms = 0, .settle_ms = 500, .policy = SI7021_HEATER_COMPENSATE,
+			.temperature_offset = 2.0f };
+	sleep_ms(config.settle_ms);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_heater_start(&config));
+
+	sample = produce();
+	TEST_ASSERT(!sample.compensated);
+
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_set_heater_status(SI7021_HEATER_ON));
+	sleep_ms(1000);
+	sample = produce();
+	TEST_ASSERT(sample.compensated);
+
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_set_heater_status(SI7021_HEATER_OFF));
+	sample = produce();
+	TEST_ASSERT(sample.compensated);
+	sleep_ms(config.settle_ms);
+	sample = produce();
+	TEST_ASSERT(!sample.compensated);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_heater_stop());
+}
+
+static void assert_offset(si7021_sample_t sample, float offset) {
+	TEST_ASSERT(sample.compensated);
+	TEST_ASSERT(fabsf(expected_temperature - offset - sample.temperature) < 1e-3f);
+}
+
+static void test_warmup_ramp() {
+	si7021_sample_t sample;
+	int64_t on_time, off_time;
+	float offset, warmth;
+	si7021_heater_config_t config = { .current = 0x4, .period_ms = 10000,
+			.on_ms = 5000, .warmup_ms = 1000, .settle_ms = 1000, .policy =
+					SI7021_HEATER_COMPENSATE, .temperature_offset = 2.0f };
+	// cold start, whatever earlier tests left has decayed
+	sleep_ms(config.settle_ms);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_heater_start(&config));
+
+	// switched on by this very call, so the sample is barely heated
+	sample = produce();
+	TEST_ASSERT(sample.compensated);
+	offset = expected_temperature - sample.temperature;
+	TEST_ASSERT(offset > 0.0f && offset < 0.2f);
+	on_time = sample.timestamp_us - (int64_t) (offset / 2.0f * 1e6f);
+
+	sleep_ms(400);
+	sample = produce();
+	warmth = (sample.timestamp_us - on_time) / 1e6f;
+	assert_offset(sample, 2.0f * warmth);
+
+	// cools down from what it reached, not from the full offset
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_set_heater_status(SI7021_HEATER_OFF));
+	off_time = esp_timer_get_time();
+	warmth = (off_time - on_time) / 1e6f;
+	sleep_ms(500);
+	sample = produce();
+	assert_offset(sample,
+			2.0f * warmth * (1.0f - (sample.timestamp_us - off_time) / 1e6f));
+
+	// fully heated warmup_ms into the next burst
+	sleep_ms(config.period_ms - 1000);
+	produce();
+	sleep_ms(1500);
+	assert_offset(produce(), 2.0f);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_heater_stop());
+}
+
+static void test_control_cost_against_manual_toggle() {
+	si7021_heater_stats_t before, after;
+	uint32_t transitions, transactions, bus_us;
+	int64_t start, period;
+	si7021_heater_config_t config = { .current = 0x2, .period_ms = 100, .on_ms =
+			50, .settle_ms = 10, .policy = SI7021_HEATER_COMPENSATE,
+			.temperature_offset = 1.0f };
+	// both register shadows start invalid, as after init
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_soft_reset());
+	sleep_ms(20);
+	si7021_get_heater_stats(&before);
+
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_heater_start(&config));
+	start = esp_timer_get_time();
+	for (int i = 0; i < 16; i++) {
+		produce();
+		sleep_ms(25);
+	}
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_heater_stop());
+	si7021_get_heater_stats(&after);
+	transitions = after.transitions - before.transitions;
+	transactions = after.transactions - before.transactions;
+	bus_us = after.bus_us - before.bus_us;
+	TEST_ASSERT(transitions >= 6);
+	// heater register write, then one user register read before the first switch
+	TEST_ASSERT_EQ(transitions + 3, transactions);
+	// one produce plus the sleep per sample
+	period = (esp_timer_get_time() - start) / 16;
+	TEST_ASSERT(llabs(period - (int64_t) after.sample_interval_us) < 1000);
+
+	// the same transitions done by hand
+	before = after;
+	for (uint32_t i = 0; i < transitions; i++) {
+		TEST_ASSERT_EQ(SI7021_ERR_OK,
+				si7021_set_heater_status(i % 2 ? SI7021_HEATER_OFF : SI7021_HEATER_ON));
+	}
+	si7021_get_heater_stats(&after);
+	TEST_ASSERT_EQ(transitions, after.manual_switches - before.manual_switches);
+	TEST_ASSERT_EQ(3 * transitions,
+			after.manual_transactions - before.manual_transactions);
+	TEST_ASSERT(bus_us < after.manual_bus_us - before.manual_bus_us);
+}
+
+static void *blocking_reader(void *arg) {
+	si7021_read_temperature();
+	return NULL;
+}
+
+static void test_stats_do_not_wait_for_bus() {
+	pthread_t thread;
+	si7021_heater_stats_t stats;
+	TEST_ASSERT_EQ(0, si7021_sim_thread_create(&thread, blocking_reader, NULL));
+	sleep_ms(1);
+
+	// the reader holds the bus for its 50 ms conversion wait
+	int64_t start = esp_timer_get_time();
+	si7021_get_heater_stats(&stats);
+	TEST_ASSERT_EQ(start, esp_timer_get_time());
+	TEST_ASSERT_EQ(0, si7021_sim_thread_join(thread));
+}
+
+int main() {
+	si7021_config_t config = { 0 };
+	si7021_sim_reset();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_init(&config));
+	expected_temperature = __si7021_raw_to_temperature(
+			si7021_sim_device()->raw_temperature);
+
+	RUN_TEST(test_manual_heater_without_controller);
+	RUN_TEST(test_heater_register_read_refreshes_shadow);
+	RUN_TEST(test_manual_toggle_tracked);
+	RUN_TEST(test_warmup_ramp);
+	RUN_TEST(test_control_cost_against_manual_toggle);
+	RUN_TEST(test_stats_do_not_wait_for_bus);
+	return 0;
+}
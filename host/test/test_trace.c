@@ -0,0 +1,112 @@
+/* This file is part of SI7021 Library for ESP-IDF framework.
+ *
+ *  SI7021 Library for ESP-IDF framework is free software: you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation, either version 3 of the License, or
+ *  (at your option) any later version.
+ *
+ *  SI7021 Library for ESP-IDF framework is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with SI7021 Library for ESP-IDF framework.  If not, see <https://www.gnu.org/licenses/>.
+ */
+/**
+ * @file test_trace.c
+ * @brief Bus trace recorder past its ring depth and across the 32 bit timestamp wrap.
+ *
+ * Built with the default #SI7021_TRACE_DEPTH so the ring overwrites its oldest entries.
+ *
+ * Usage: test_trace [trace.bin] dumps the recorded ring for si7021_replay.
+ */
+
+#include "si7021_sim.h"
+#include "esp_timer.h"
+#include "test.h"
+#include <string.h>
+
+#define PLAIN_READS		40
+#define DEADLINE_READS	2
+// a write and a read per plain read, a deadline entry, a write and a read per deadline read,
+// and a final availability probe
+#define TOTAL_ENTRIES	(2 * PLAIN_READS + 3 * DEADLINE_READS + 1)
+#define TAIL			10
+
+static si7021_trace_entry_t entries[SI7021_TRACE_DEPTH];
+
+static void test_ring_overflow_across_wrap() {
+	si7021_trace_entry_t tail[TAIL];
+	uint32_t dropped, wraps = 0;
+	uint32_t previous = 0;
+	float value;
+	size_t count;
+
+	// the plain reads, 50 ms each, straddle 2^32 us
+	si7021_sim_sleep_until((1LL << 32) - 1000000);
+	si7021_trace_clear();
+	si7021_trace_enable(true);
+	for (int i = 0; i < PLAIN_READS; i++) {
+		TEST_ASSERT(si7021_read_temperature() != -999);
+	}
+	for (int i = 0; i < DEADLINE_READS; i++) {
+		TEST_ASSERT_EQ(SI7021_ERR_OK,
+				si7021_read_temperature_deadline(esp_timer_get_time() + 30000,
+						&value));
+	}
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_check_availability());
+	si7021_trace_enable(false);
+	TEST_ASSERT(esp_timer_get_time() > (1LL << 32));
+
+	count = si7021_trace_snapshot(entries, SI7021_TRACE_DEPTH, &dropped);
+	TEST_ASSERT_EQ(SI7021_TRACE_DEPTH, count);
+	TEST_ASSERT_EQ(TOTAL_ENTRIES - SI7021_TRACE_DEPTH, dropped);
+	// the write of the oldest kept read was overwritten
+	TEST_ASSERT_EQ(SI7021_TRACE_OP_READ, entries[0].op);
+	TEST_ASSERT_EQ(SI7021_TRACE_OP_WRITE, entries[count - 1].op);
+	TEST_ASSERT_EQ(0, entries[count - 1].len);
+	for (size_t i = 0; i < count; i++) {
+		if (entries[i].op == SI7021_TRACE_OP_DEADLINE) {
+			continue;
+		}
+		if (i > 0 && entries[i].timestamp_us < previous) {
+			wraps++;
+		}
+		previous = entries[i].timestamp_us;
+	}
+	TEST_ASSERT_EQ(1, wraps);
+
+	// a smaller buffer gets the newest entries, the rest count as dropped
+	TEST_ASSERT_EQ(TAIL, si7021_trace_snapshot(tail, TAIL, &dropped));
+	TEST_ASSERT_EQ(TOTAL_ENTRIES - TAIL, dropped);
+	TEST_ASSERT(memcmp(tail, entries + count - TAIL, sizeof(tail)) == 0);
+}
+
+static void test_dump_header(const char *path) {
+	si7021_trace_header_t header;
+	FILE *file = fopen(path, "wb");
+	TEST_ASSERT(file != NULL);
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_trace_dump(file));
+	fclose(file);
+
+	file = fopen(path, "rb");
+	TEST_ASSERT(file != NULL);
+	TEST_ASSERT_EQ(1, fread(&header, sizeof(header), 1, file));
+	TEST_ASSERT(memcmp(header.magic, SI7021_TRACE_MAGIC, sizeof(header.magic)) == 0);
+	TEST_ASSERT_EQ(SI7021_TRACE_DEPTH, header.count);
+	TEST_ASSERT_EQ(TOTAL_ENTRIES - SI7021_TRACE_DEPTH, header.dropped);
+	fclose(file);
+}
+
+int main(int argc, char **argv) {
+	si7021_config_t config = { 0 };
+	si7021_sim_reset();
+	TEST_ASSERT_EQ(SI7021_ERR_OK, si7021_init(&config));
+
+	RUN_TEST(test_ring_overflow_across_wrap);
+	if (argc > 1) {
+		test_dump_header(argv[1]);
+	}
+	return 0;
+}
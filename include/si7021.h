@@ -34,6 +34,7 @@ extern "C" {
 #include "esp_err.h"
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
+#include "freertos/semphr.h"
 #include "driver/i2c.h"
 #include <stdlib.h>
 #include <stdio.h>
@@ -75,6 +76,7 @@ extern "C" {
 #define SI7021_ERR_FAIL		 		0x05		/*!< Generic FAIL return value */
 #define SI7021_ERR_INVALID_STATE	0x06		/*!< Sensor in a invalid state */
 #define SI7021_ERR_TIMEOUT	 		0x07		/*!< Timed out communicating with sensor */
+#define SI7021_ERR_DEADLINE	 		0x08		/*!< Deadline exceeded before the measurement completed */
 
 /**
  * @}
@@ -102,6 +104,55 @@ typedef enum SI7021_VDD_STATUS {
 #define SI7021_HEATER_ON			0x01		/*!< Heater is ON */
 #define SI7021_HEATER_OFF			0x00		/*!< Heater is OFF */
 
+#define SI7021_HEATER_EXCLUDE		0x00		/*!< Samples taken while the heater is warm are not delivered */
+#define SI7021_HEATER_COMPENSATE	0x01		/*!< Samples taken while the heater is warm are corrected */
+
+#define SI7021_CACHE_TEMPERATURE	0x00		/*!< Cache slot of temperature samples */
+#define SI7021_CACHE_HUMIDITY		0x01		/*!< Cache slot of humidity samples */
+
+#ifndef SI7021_DEADLINE_MIN_PHASE_US
+#define SI7021_DEADLINE_MIN_PHASE_US	1000	/*!< A bus phase is not started with less budget left than this (or one tick, if longer) */
+#endif
+
+#ifndef SI7021_DEADLINE_POLL_US
+#define SI7021_DEADLINE_POLL_US		1000		/*!< Interval between result polls after the typical conversion time */
+#endif
+
+#ifndef SI7021_MAX_SUBSCRIBERS
+#define SI7021_MAX_SUBSCRIBERS		8			/*!< Maximum number of sample subscribers */
+#endif
+
+#ifndef SI7021_DISPATCHER_STACK
+#define SI7021_DISPATCHER_STACK		3072		/*!< Stack size of the task running subscriber callbacks */
+#endif
+
+#ifndef SI7021_DISPATCHER_PRIORITY
+#define SI7021_DISPATCHER_PRIORITY	(tskIDLE_PRIORITY + 2)	/*!< Priority of the task running subscriber callbacks */
+#endif
+
+/**
+ * @defgroup SI7021_TRACE SI7021 Bus Trace
+ *
+ * @{
+ */
+#ifndef SI7021_TRACE_DEPTH
+#define SI7021_TRACE_DEPTH			64			/*!< Number of bus phases kept in the trace ring, must be a power of two */
+#endif
+#define SI7021_TRACE_MAX_DATA		6			/*!< Maximum number of data bytes stored per bus phase */
+#define SI7021_TRACE_MAGIC			"S7TR"		/*!< Magic bytes at the start of a dumped trace file */
+#define SI7021_TRACE_VERSION		0x02		/*!< Version of the dumped trace file format, 2 adds #SI7021_TRACE_OP_DEADLINE */
+
+#define SI7021_TRACE_OP_WRITE		0x00		/*!< Bus phase is a write (command and arguments) */
+#define SI7021_TRACE_OP_READ		0x01		/*!< Bus phase is a read (response bytes) */
+#define SI7021_TRACE_OP_DEADLINE	0x02		/*!< Not a bus phase: the next command (data[0]) was issued by a deadline read, timestamp is the deadline */
+
+#define SI7021_TRACE_CRC_NONE		0x00		/*!< No CRC checked for this bus phase */
+#define SI7021_TRACE_CRC_OK			0x01		/*!< Response CRC was valid */
+#define SI7021_TRACE_CRC_BAD		0x02		/*!< Response CRC was invalid */
+/**
+ * @}
+ */
+
 /**
  * @brief SI7021 initialization parameter
  * @see #__si7021_config
@@ -120,10 +171,117 @@ typedef struct si7021_config_t {
  */
 typedef uint8_t si7021_err_t;
 
+/**
+ * @brief One recorded bus phase.
+ * @note A measurement is recorded as a write phase (command byte) followed by a read phase
+ * (response bytes and CRC result).
+ */
+typedef struct si7021_trace_entry_t {
+	uint32_t timestamp_us; /*!< esp_timer time at the start of the phase, truncated to 32 bits (wraps every 71.6 minutes) */
+	int16_t err; /*!< esp_err_t returned by i2c_master_cmd_begin() */
+	uint8_t op; /*!< One of SI7021_TRACE_OP_* */
+	uint8_t len; /*!< Number of bytes written or requested */
+	uint8_t data[SI7021_TRACE_MAX_DATA]; /*!< Bytes written, or bytes read (zero if the read failed) */
+	uint8_t crc; /*!< CRC result, one of SI7021_TRACE_CRC_* */
+	uint8_t reserved; /*!< Padding, always 0 */
+} si7021_trace_entry_t;
+
+/**
+ * @brief Header of a dumped trace file, followed by #si7021_trace_header_t::count entries.
+ * @note All fields are little endian. Readers rebuild 64 bit time from the signed 32 bit difference
+ * between consecutive bus phases, so a trace stays ordered across a wrap as long as no two consecutive
+ * phases are more than 35.8 minutes apart. A #SI7021_TRACE_OP_DEADLINE entry is relative to the bus
+ * phase before it.
+ */
+typedef struct si7021_trace_header_t {
+	char magic[4]; /*!< #SI7021_TRACE_MAGIC */
+	uint8_t version; /*!< #SI7021_TRACE_VERSION */
+	uint8_t entry_size; /*!< sizeof(#si7021_trace_entry_t) */
+	uint16_t count; /*!< Number of entries following the header, oldest first */
+	uint32_t dropped; /*!< Number of older entries overwritten before the dump */
+} si7021_trace_header_t;
+
+/**
+ * @brief Counters of the sample cache
+ * @see #si7021_get_cache_stats()
+ */
+typedef struct si7021_cache_stats_t {
+	uint32_t hits; /*!< Calls served from a sample younger than max_age_us */
+	uint32_t misses; /*!< Calls that started a measurement */
+	uint32_t coalesced; /*!< Calls that waited for a measurement started by another caller */
+} si7021_cache_stats_t;
+
+/**
+ * @brief A temperature and Relative Humidity sample shared with subscribers
+ */
+typedef struct si7021_sample_t {
+	float temperature; /*!< Temperature in Celsius */
+	float humidity; /*!< Relative Humidity in percentage */
+	int64_t timestamp_us; /*!< esp_timer time the sample was taken */
+	uint32_t sequence; /*!< Sample number, starting from 1 */
+	bool compensated; /*!< true if corrected for heater self-heating */
+} si7021_sample_t;
+
+/**
+ * @brief Subscriber handle
+ */
+typedef uint8_t si7021_subscriber_t;
+
+/**
+ * @brief Subscriber callback, called from the dispatcher task, never from the producer
+ * @param sample Latest sample, only valid during the call
+ * @param arg Argument given to #si7021_subscribe_callback()
+ */
+typedef void (*si7021_sample_cb_t)(const si7021_sample_t *sample, void *arg);
+
+/**
+ * @brief Counters of a subscriber
+ * @see #si7021_get_subscriber_stats()
+ */
+typedef struct si7021_subscriber_stats_t {
+	uint32_t delivered; /*!< Samples delivered after applying the rate divider */
+	uint32_t dropped; /*!< Samples overwritten before the subscriber read them */
+	uint32_t lag; /*!< Samples published since the subscriber last read one */
+} si7021_subscriber_stats_t;
+
+/**
+ * @brief Heater duty-cycle controller configuration
+ * @see #si7021_heater_start()
+ */
+typedef struct si7021_heater_config_t {
+	uint8_t current; /*!< Heater register value, 0x0 (3.09mA) to 0xF (94.20mA) */
+	uint32_t period_ms; /*!< Duty cycle period */
+	uint32_t on_ms; /*!< Heater burst length per period, at most period_ms */
+	uint32_t warmup_ms; /*!< Time for the self-heating to build up to temperature_offset after the heater goes on, 0 for at once */
+	uint32_t settle_ms; /*!< Time after a burst during which the sensor is still considered warm */
+	uint8_t policy; /*!< #SI7021_HEATER_EXCLUDE or #SI7021_HEATER_COMPENSATE */
+	float temperature_offset; /*!< Self-heating at this current in Celsius, calibrated per board */
+} si7021_heater_config_t;
+
+/**
+ * @brief Counters of the heater controller
+ *
+ * Bus cost is measured around each switch, so the controller's transactions per transition can be
+ * compared with the manual_ counters of #si7021_set_heater_status() toggling.
+ * @see #si7021_get_heater_stats()
+ */
+typedef struct si7021_heater_stats_t {
+	uint32_t transitions; /*!< Heater switched on or off by the controller */
+	uint32_t transactions; /*!< Bus transactions the controller spent on the heater, register reads included */
+	uint32_t bus_us; /*!< Bus time the controller spent on the heater */
+	uint32_t manual_switches; /*!< Successful #si7021_set_heater_status() calls, the baseline */
+	uint32_t manual_transactions; /*!< Bus transactions spent in #si7021_set_heater_status() */
+	uint32_t manual_bus_us; /*!< Bus time spent in #si7021_set_heater_status() */
+	uint32_t samples; /*!< Samples produced while the controller was configured */
+	uint32_t samples_excluded; /*!< Warm samples not delivered */
+	uint32_t samples_compensated; /*!< Warm samples delivered after correction */
+	uint32_t sample_interval_us; /*!< Mean interval between samples since the controller was last started */
+} si7021_heater_stats_t;
+
 /**
  * @brief Internal variable for storing sensor information.
  */
-si7021_config_t __si7021_config;
+extern si7021_config_t __si7021_config;
 
 /**
  * @brief Initialize SI7021 sensor
@@ -165,6 +323,28 @@ si7021_err_t __si7021_driver_config(si7021_config_t *config);
  */
 uint16_t __si7021_read(uint8_t cmd);
 
+/**
+ * @brief Write bytes to sensor in a single I2C transaction
+ * @note Internal use only, every write on the bus goes through here and is recorded in the trace.
+ * Called with the bus locked; first waits out a conversion abandoned at a deadline.
+ * @param data Bytes to write after the address byte, may be NULL if len is 0
+ * @param len Number of bytes to write, 0 only probes the address
+ * @param ticks_to_wait Maximum ticks to wait for the transaction
+ * @return esp_err_t returned by i2c_master_cmd_begin()
+ */
+esp_err_t __si7021_bus_write(const uint8_t *data, size_t len,
+		TickType_t ticks_to_wait);
+
+/**
+ * @brief Read bytes from sensor in a single I2C transaction
+ * @note Internal use only, every read on the bus goes through here and is recorded in the trace
+ * @param data Buffer receiving the bytes
+ * @param len Number of bytes to read, the last one is NACKed
+ * @param ticks_to_wait Maximum ticks to wait for the transaction
+ * @return esp_err_t returned by i2c_master_cmd_begin()
+ */
+esp_err_t __si7021_bus_read(uint8_t *data, size_t len, TickType_t ticks_to_wait);
+
 /**
  * @brief Check data integrity with crc
  * @param value 16bit (uint16_t) value that contain data return by sensors.
@@ -194,6 +374,365 @@ float si7021_read_temperature();
  */
 float si7021_read_humidity();
 
+/**
+ * @brief Read temperature, giving up at an absolute deadline
+ * @param deadline_us esp_timer time (esp_timer_get_time()) by which the call must return
+ * @param temperature Receives temperature in Celsius
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_DEADLINE The measurement cannot complete by the deadline, or a transaction timed
+ * 		  out within it; temperature is not written
+ * 		- #SI7021_ERR_INVALID_ARG temperature is NULL
+ * 		- #SI7021_ERR_FAIL CRC mismatch or bus error
+ * @note Instead of a fixed 50 ms wait, the result is first polled after the typical conversion
+ * time, then every #SI7021_DEADLINE_POLL_US until the sensor stops NACKing. Waits shorter than a
+ * tick are busy waits. Every bus wait is a whole number of ticks that fits in the remaining
+ * budget, so the call returns by the deadline; it fails at once if the command and the typical
+ * conversion cannot fit. With a 100 Hz tick each transaction needs 10 ms of budget left, so a
+ * temperature read needs about 20 ms and a RH read about 30 ms. Every transaction ends with a
+ * STOP, and a conversion abandoned at the deadline is waited out before the next command of any
+ * API is sent.
+ */
+si7021_err_t si7021_read_temperature_deadline(int64_t deadline_us,
+		float *temperature);
+
+/**
+ * @brief Read Relative Humidity, giving up at an absolute deadline
+ * @param deadline_us esp_timer time (esp_timer_get_time()) by which the call must return
+ * @param humidity Receives Relative Humidity in percentage
+ * @return Same as #si7021_read_temperature_deadline()
+ * @note A full resolution RH conversion takes 17 ms typically and up to 22.8 ms.
+ */
+si7021_err_t si7021_read_humidity_deadline(int64_t deadline_us,
+		float *humidity);
+
+/**
+ * @brief Measure with a deadline
+ * @note Internal use only
+ * @param command #SI7021_MEASTEMP_NOHOLD_CMD or #SI7021_MEASRH_NOHOLD_CMD
+ * @param deadline_us esp_timer time by which the call must return
+ * @param raw_value Receives the raw measurement code
+ * @return Same as #si7021_read_temperature_deadline()
+ */
+si7021_err_t __si7021_read_deadline(uint8_t command, int64_t deadline_us,
+		uint16_t *raw_value);
+
+/**
+ * @brief Wait until a conversion abandoned at a deadline is finished
+ * @note Internal use only, called with the bus locked
+ * @param latest_us Latest acceptable return time, see #__si7021_sleep_until()
+ */
+void __si7021_wait_idle(int64_t latest_us);
+
+/**
+ * @brief Sleep until an esp_timer time
+ * @note Internal use only
+ * @param time_us Earliest wake up time
+ * @param latest_us Latest acceptable wake up time; when blocking could overshoot it, the last
+ * part of the wait is a busy wait
+ */
+void __si7021_sleep_until(int64_t time_us, int64_t latest_us);
+
+/**
+ * @brief Ticks left until a deadline
+ * @note Internal use only
+ * @return Whole ticks until deadline_us, 0 when less than one tick is left. A wait of that
+ * many ticks cannot end after deadline_us.
+ */
+TickType_t __si7021_ticks_until(int64_t deadline_us);
+
+/**
+ * @brief Convert esp_err_t of a transaction with a deadline to si7021_err_t
+ * @note Internal use only
+ * @return #SI7021_ERR_DEADLINE for a timeout, since timeouts are derived from the deadline,
+ * otherwise the matching error
+ */
+si7021_err_t __si7021_esp_err(esp_err_t err);
+
+/**
+ * @brief Read temperature, reusing a recent sample when possible
+ * @param max_age_us Maximum age of a cached sample in microseconds
+ * @return float value, temperature in Celsius, -999 if the measurement failed
+ * @note If another task is already measuring, the call waits for that measurement instead of
+ * starting a new one. Requires #si7021_init() to have created the bus mutex.
+ */
+float si7021_read_temperature_cached(uint32_t max_age_us);
+
+/**
+ * @brief Read Relative Humidity, reusing a recent sample when possible
+ * @param max_age_us Maximum age of a cached sample in microseconds
+ * @return float value, Relative Humidity in percentage, -999 if the measurement failed
+ * @see #si7021_read_temperature_cached()
+ */
+float si7021_read_humidity_cached(uint32_t max_age_us);
+
+/**
+ * @brief Read temperature and Relative Humidity, reusing recent samples when possible
+ * @param max_age_us Maximum age of the cached samples in microseconds
+ * @param temperature Receives temperature in Celsius, -999 on failure
+ * @param humidity Receives Relative Humidity in percentage, -999 on failure
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG temperature or humidity is NULL
+ * 		- #SI7021_ERR_FAIL Measurement failed
+ * @note A miss costs a single conversion: temperature is read back from the RH measurement.
+ */
+si7021_err_t si7021_read_pair_cached(uint32_t max_age_us, float *temperature,
+		float *humidity);
+
+/**
+ * @brief Get the sample cache counters
+ * @param stats Receives the counters
+ */
+void si7021_get_cache_stats(si7021_cache_stats_t *stats);
+
+/**
+ * @brief Reset the sample cache counters
+ */
+void si7021_reset_cache_stats();
+
+/**
+ * @brief Subscribe a callback to new samples
+ * @param callback Called from the dispatcher task with a pointer to the latest sample
+ * @param arg Passed to callback
+ * @param divider Deliver one sample out of divider, 1 delivers every sample
+ * @param subscriber Receives the subscriber handle
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG callback or subscriber is NULL, or divider is 0
+ * 		- #SI7021_ERR_FAIL #SI7021_MAX_SUBSCRIBERS already subscribed, or the dispatcher task
+ * 		  could not be created
+ * @note The first call creates the dispatcher task. The producer only notifies it, like a task
+ * subscriber, and it runs the callbacks one after another. A slow callback delays the others
+ * but never the producer; a delivery still pending when the next one is due is counted as dropped.
+ */
+si7021_err_t si7021_subscribe_callback(si7021_sample_cb_t callback, void *arg,
+		uint8_t divider, si7021_subscriber_t *subscriber);
+
+/**
+ * @brief Subscribe a task to new samples
+ * @param task Task notified (xTaskNotifyGive()) on each delivered sample, it then calls #si7021_subscriber_read()
+ * @param divider Deliver one sample out of divider, 1 delivers every sample
+ * @param subscriber Receives the subscriber handle
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG task or subscriber is NULL, or divider is 0
+ * 		- #SI7021_ERR_FAIL #SI7021_MAX_SUBSCRIBERS already subscribed
+ * @note The producer never waits for the task. A sample the task did not read before the next
+ * delivery is counted as dropped.
+ */
+si7021_err_t si7021_subscribe_task(TaskHandle_t task, uint8_t divider,
+		si7021_subscriber_t *subscriber);
+
+/**
+ * @brief Remove a subscriber
+ * @param subscriber Handle returned when subscribing
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG Invalid handle
+ * @note A sample being dispatched concurrently may still reach the subscriber once.
+ */
+si7021_err_t si7021_unsubscribe(si7021_subscriber_t subscriber);
+
+/**
+ * @brief Measure temperature and Relative Humidity once and deliver the sample to subscribers
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_FAIL Measurement failed, nothing delivered
+ * @note Call periodically from a single producer task. The sample is stored once in a seqlock
+ * protected slot; no I2C read or copy is made per subscriber. Each call measures and refreshes
+ * the cache, but is not counted in #si7021_cache_stats_t.
+ */
+si7021_err_t si7021_sample_produce();
+
+/**
+ * @brief Read the latest produced sample
+ * @param sample Receives the sample
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG sample is NULL
+ * 		- #SI7021_ERR_INVALID_STATE No sample produced yet
+ */
+si7021_err_t si7021_sample_latest(si7021_sample_t *sample);
+
+/**
+ * @brief Read the latest produced sample on behalf of a subscriber, clearing its lag
+ * @param subscriber Handle returned when subscribing
+ * @param sample Receives the sample
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG Invalid handle or sample is NULL
+ * 		- #SI7021_ERR_INVALID_STATE No sample produced yet
+ */
+si7021_err_t si7021_subscriber_read(si7021_subscriber_t subscriber,
+		si7021_sample_t *sample);
+
+/**
+ * @brief Get delivery counters of a subscriber
+ * @param subscriber Handle returned when subscribing
+ * @param stats Receives the counters
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG Invalid handle or stats is NULL
+ * 		- #SI7021_ERR_INVALID_STATE Subscriber is not active
+ */
+si7021_err_t si7021_get_subscriber_stats(si7021_subscriber_t subscriber,
+		si7021_subscriber_stats_t *stats);
+
+/**
+ * @brief Start the heater duty-cycle controller
+ * @param config Controller configuration, copied
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG Invalid configuration
+ * 		- Error of #si7021_set_heater_register() if the current could not be set
+ * @note The controller is driven by #si7021_sample_produce(): each call switches the heater at
+ * most once, with a single write of a cached copy of the user register, and still takes its
+ * sample. Samples from #si7021_read_temperature() and the cached reads are not corrected. Until
+ * the first call, a heater switched with #si7021_set_heater_status() leaves samples untouched.
+ */
+si7021_err_t si7021_heater_start(const si7021_heater_config_t *config);
+
+/**
+ * @brief Stop the heater duty-cycle controller, switching the heater off if needed
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- Error of the register write otherwise
+ * @note Samples stay excluded or compensated until settle_ms after the heater went off.
+ */
+si7021_err_t si7021_heater_stop();
+
+/**
+ * @brief Get the heater controller counters
+ * @param stats Receives the counters
+ * @note Never waits for the bus, the counters have their own short critical section.
+ */
+void si7021_get_heater_stats(si7021_heater_stats_t *stats);
+
+/**
+ * @brief Switch the heater with a single user register write
+ * @note Internal use only, called with the bus locked
+ * @param on true to switch the heater on
+ */
+si7021_err_t __si7021_heater_switch(bool on);
+
+/**
+ * @brief Record the heater going on or off
+ * @note Internal use only, called with the bus locked whenever the sensor heater bit changes
+ * @param on true if the heater is now on
+ */
+void __si7021_heater_set_state(bool on);
+
+/**
+ * @brief Fraction of temperature_offset the sensor is heated by
+ * @note Internal use only, called with __si7021_heater_lock held
+ * @param time_us esp_timer time
+ * @return 0 (cold) to 1 (fully heated). Self-heating builds up linearly over warmup_ms from the
+ * warmth left at switch on, and decays linearly over settle_ms from the warmth reached at switch off.
+ */
+float __si7021_heater_warmth(int64_t time_us);
+
+/**
+ * @brief Advance the heater duty cycle
+ * @note Internal use only
+ */
+void __si7021_heater_step();
+
+/**
+ * @brief Exclude or compensate a sample taken while the heater is warm
+ * @note Internal use only
+ * @param sample Sample to correct in place
+ * @return false if the sample must not be delivered
+ */
+bool __si7021_heater_adjust(si7021_sample_t *sample);
+
+/**
+ * @brief Add a subscriber to the subscriber table
+ * @note Internal use only
+ */
+si7021_err_t __si7021_subscribe(si7021_sample_cb_t callback, void *arg,
+		TaskHandle_t task, uint8_t divider, si7021_subscriber_t *subscriber);
+
+/**
+ * @brief Run the callbacks of subscribers with a pending delivery, notified by the producer
+ * @note Internal use only, task function of the dispatcher
+ * @param arg Unused
+ */
+void __si7021_dispatcher_task(void *arg);
+
+/**
+ * @brief Write a sample to the seqlock protected slot
+ * @note Internal use only, single writer
+ * @param sample Sample to publish
+ */
+void __si7021_sample_publish(const si7021_sample_t *sample);
+
+/**
+ * @brief Serve a cached read, measuring or waiting for an in-flight measurement if needed
+ * @note Internal use only
+ * @param quantity #SI7021_CACHE_TEMPERATURE or #SI7021_CACHE_HUMIDITY
+ * @param max_age_us Maximum age of a cached sample in microseconds
+ * @return float value, converted sample, -999 if the measurement failed
+ */
+float __si7021_read_cached(uint8_t quantity, uint32_t max_age_us);
+
+/**
+ * @brief Measure temperature and Relative Humidity with a single conversion and cache both
+ * @note Internal use only, leaves the cache counters alone
+ * @param temperature Receives temperature in Celsius, -999 on failure
+ * @param humidity Receives Relative Humidity in percentage, -999 on failure
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_FAIL Measurement failed
+ */
+si7021_err_t __si7021_read_pair(float *temperature, float *humidity);
+
+/**
+ * @brief Store a new sample in the cache and wake up coalesced callers
+ * @note Internal use only
+ * @param quantity #SI7021_CACHE_TEMPERATURE or #SI7021_CACHE_HUMIDITY
+ * @param value Converted sample, -999 marks a failed measurement
+ */
+void __si7021_cache_store(uint8_t quantity, float value);
+
+/**
+ * @brief Convert raw temperature code to Celsius
+ * @note Internal use only
+ */
+float __si7021_raw_to_temperature(uint16_t raw_temp);
+
+/**
+ * @brief Convert raw RH code to percentage
+ * @note Internal use only
+ */
+float __si7021_raw_to_humidity(uint16_t raw_humidity);
+
+/**
+ * @brief Read the temperature measured during the last RH measurement
+ * @note Internal use only
+ * @return 16bit value (uint16_t) raw temperature code, 0 if failed to read
+ */
+uint16_t __si7021_read_previous_temperature();
+
+/**
+ * @brief Take the bus mutex, so multi-phase transactions are not interleaved
+ * @note Internal use only, recursive, no-op before #si7021_init()
+ */
+void __si7021_bus_lock();
+
+/**
+ * @brief Take the bus mutex, waiting at most ticks_to_wait
+ * @note Internal use only, always succeeds before #si7021_init()
+ * @return true if the bus is locked
+ */
+bool __si7021_bus_try_lock(TickType_t ticks_to_wait);
+
+/**
+ * @brief Give the bus mutex back
+ * @note Internal use only
+ */
+void __si7021_bus_unlock();
+
 /**
  * @brief Read RH/T user register 1 from sensor
  * @note Internal use only
@@ -216,6 +755,13 @@ uint8_t __si7021_read_user_register();
  */
 si7021_err_t __si7021_write_user_register(uint8_t value);
 
+/**
+ * @brief Update the cached copy of RH/T user register 1 and the heater state derived from it
+ * @note Internal use only, called with the bus locked after the register was read or written
+ * @param value Register value now in the sensor
+ */
+void __si7021_user_reg_update(uint8_t value);
+
 /**
  * @brief Get current resolution of sensor
  * @return
@@ -311,6 +857,59 @@ uint8_t si7021_get_heater_status();
  */
 uint64_t get_electronic_id();
 
+/**
+ * @brief Record a bus phase in the trace ring
+ * @note Internal use only, called by #__si7021_bus_write(), #__si7021_bus_read() and
+ * #__si7021_read_deadline()
+ * @param op One of SI7021_TRACE_OP_*
+ * @param data Bytes written or read
+ * @param len Number of bytes, truncated to #SI7021_TRACE_MAX_DATA
+ * @param err Result of the transaction
+ * @param timestamp_us esp_timer time at the start of the transaction
+ */
+void __si7021_trace_record(uint8_t op, const uint8_t *data, size_t len,
+		esp_err_t err, int64_t timestamp_us);
+
+/**
+ * @brief Attach a CRC result to the last recorded read phase
+ * @note Internal use only, call before #__si7021_bus_unlock() so no other phase is recorded in between
+ * @param valid Result of #__is_crc_valid()
+ */
+void __si7021_trace_mark_crc(bool valid);
+
+/**
+ * @brief Enable or disable the bus trace recorder
+ * @param enable true to start recording, false to stop
+ * @note Disabled by default. When enabled each bus phase costs one short critical section and a 16 byte copy.
+ */
+void si7021_trace_enable(bool enable);
+
+/**
+ * @brief Discard every recorded entry
+ */
+void si7021_trace_clear();
+
+/**
+ * @brief Copy the recorded entries, oldest first
+ * @param entries Buffer receiving the entries
+ * @param max_entries Capacity of entries, only the newest max_entries are copied
+ * @param dropped If not NULL, receives the number of older entries not copied
+ * @return Number of entries copied
+ */
+size_t si7021_trace_snapshot(si7021_trace_entry_t *entries, size_t max_entries,
+		uint32_t *dropped);
+
+/**
+ * @brief Dump the trace to a binary file
+ * @param file File opened for writing in binary mode
+ * @return
+ * 		- #SI7021_ERR_OK Success
+ * 		- #SI7021_ERR_INVALID_ARG file is NULL
+ * 		- #SI7021_ERR_FAIL Out of memory or failed to write
+ * @note The file is a #si7021_trace_header_t followed by the entries, see host/si7021_replay.c to replay it
+ */
+si7021_err_t si7021_trace_dump(FILE *file);
+
 #ifdef __cplusplus
 }
 #endif
@@ -25,17 +25,111 @@
  */
 
 #include "si7021.h"
+#include "esp_timer.h"
+#if __has_include("esp_rom_sys.h")
+#include "esp_rom_sys.h"
+#else
+#include "rom/ets_sys.h"
+#define esp_rom_delay_us(us)		ets_delay_us(us)
+#endif
+#include <string.h>
+#include <math.h>
+
+#define SI7021_I2C_TIMEOUT_TICKS	(1000 / portTICK_PERIOD_MS)
+#define SI7021_TRACE_MASK			(SI7021_TRACE_DEPTH - 1)
+#define SI7021_TICK_US				(portTICK_PERIOD_MS * 1000)
+#define SI7021_CONV_TEMP_US			10800	// max conversion time, 14bit temperature
+#define SI7021_CONV_RH_US			22800	// max conversion time, 12bit RH and 14bit temperature
+#define SI7021_TYP_TEMP_US			7000	// typical conversion time, 14bit temperature
+#define SI7021_TYP_RH_US			17000	// typical conversion time, 12bit RH and 14bit temperature
+#define SI7021_COMMAND_US			200		// address and command byte, 100 kHz bus or faster
+// a transaction may wait its whole timeout, which is at least one tick
+#define SI7021_PHASE_US				(SI7021_TICK_US > SI7021_DEADLINE_MIN_PHASE_US ? \
+										SI7021_TICK_US : SI7021_DEADLINE_MIN_PHASE_US)
+
+_Static_assert((SI7021_TRACE_DEPTH & SI7021_TRACE_MASK) == 0,
+		"SI7021_TRACE_DEPTH must be a power of two");
+_Static_assert(SI7021_TRACE_DEPTH <= UINT16_MAX,
+		"dumped trace count is 16 bits");
+_Static_assert(sizeof(si7021_trace_entry_t) == 16,
+		"trace entries are dumped as fixed 16 byte records");
 
 si7021_config_t __si7021_config = { .sensors_config = { .mode = I2C_MODE_MASTER,
 		.sda_io_num = GPIO_NUM_22, .scl_io_num = GPIO_NUM_23, .sda_pullup_en =
 				GPIO_PULLUP_ENABLE, .scl_pullup_en = GPIO_PULLUP_ENABLE,
 		.master = { .clk_speed = 400000 }, }, .si7021_port = I2C_NUM_0 };
 
+static si7021_trace_entry_t __si7021_trace_ring[SI7021_TRACE_DEPTH];
+static uint32_t __si7021_trace_total = 0;
+static volatile bool __si7021_trace_enabled = false;
+static portMUX_TYPE __si7021_trace_lock = portMUX_INITIALIZER_UNLOCKED;
+
+static SemaphoreHandle_t __si7021_bus_mutex = NULL;
+// every transaction runs under the bus lock, which also guards these
+static uint32_t __si7021_bus_transactions = 0;
+static uint32_t __si7021_bus_time_us = 0;
+static portMUX_TYPE __si7021_cache_lock = portMUX_INITIALIZER_UNLOCKED;
+static float __si7021_cache_value[2];
+static int64_t __si7021_cache_time[2];
+static bool __si7021_cache_valid[2] = { false, false };
+static uint32_t __si7021_cache_generation[2] = { 0, 0 };
+static si7021_cache_stats_t __si7021_cache_stats = { 0 };
+
+typedef struct si7021_subscriber_entry_t {
+	bool active;
+	si7021_sample_cb_t callback;
+	void *arg;
+	TaskHandle_t task;
+	uint8_t divider;
+	uint8_t countdown;
+	uint32_t delivered_sequence;
+	uint32_t read_sequence;
+	uint32_t delivered;
+	uint32_t dropped;
+} si7021_subscriber_entry_t;
+
+static si7021_sample_t __si7021_sample_slot;
+static uint32_t __si7021_sample_seqlock = 0;
+static si7021_subscriber_entry_t __si7021_subscribers[SI7021_MAX_SUBSCRIBERS];
+static TaskHandle_t __si7021_dispatcher = NULL;
+
+static int64_t __si7021_busy_until_us = 0;
+
+static uint8_t __si7021_user_reg_shadow;
+static bool __si7021_user_reg_valid = false;
+static uint8_t __si7021_heater_reg_shadow;
+static bool __si7021_heater_reg_valid = false;
+
+// heater state is written holding both the bus and __si7021_heater_lock, so either is enough
+// to read it; the counters are only touched under __si7021_heater_lock
+static portMUX_TYPE __si7021_heater_lock = portMUX_INITIALIZER_UNLOCKED;
+static si7021_heater_config_t __si7021_heater_config;
+// set by the first si7021_heater_start(), stays set after stop so settle_ms still applies
+static bool __si7021_heater_configured = false;
+static bool __si7021_heater_enabled = false;
+static bool __si7021_heater_on = false;
+static int64_t __si7021_heater_period_start = 0;
+static int64_t __si7021_heater_on_time = 0;
+static int64_t __si7021_heater_off_time = 0;
+static float __si7021_heater_on_warmth = 0.0f;
+static float __si7021_heater_off_warmth = 0.0f;
+static si7021_heater_stats_t __si7021_heater_stats = { 0 };
+static int64_t __si7021_heater_first_sample = 0;
+static int64_t __si7021_heater_last_sample = 0;
+static uint32_t __si7021_heater_interval_samples = 0;
+static portMUX_TYPE __si7021_subscriber_lock = portMUX_INITIALIZER_UNLOCKED;
+
 si7021_err_t si7021_init(si7021_config_t *config) {
 	si7021_err_t err = __si7021_param_config(config);
 	if (err != SI7021_ERR_OK) {
 		return err;
 	}
+	if (__si7021_bus_mutex == NULL) {
+		__si7021_bus_mutex = xSemaphoreCreateRecursiveMutex();
+		if (__si7021_bus_mutex == NULL) {
+			return SI7021_ERR_INSTALL;
+		}
+	}
 	err = __si7021_driver_config(config);
 	if (err != SI7021_ERR_OK) {
 		return err;
@@ -70,13 +164,9 @@ si7021_err_t __si7021_driver_config(si7021_config_t *config) {
 
 si7021_err_t si7021_check_availability() {
 	esp_err_t err;
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	__si7021_bus_lock();
+	err = __si7021_bus_write(NULL, 0, SI7021_I2C_TIMEOUT_TICKS);
+	__si7021_bus_unlock();
 	if (err != ESP_OK) {
 		return SI7021_ERR_NOTFOUND;
 	}
@@ -88,7 +178,7 @@ float si7021_read_temperature() {
 	if (raw_temp == 0) {
 		return -999;
 	}
-	return (raw_temp * 175.72 / 65536.0) - 46.85;
+	return __si7021_raw_to_temperature(raw_temp);
 }
 
 float si7021_read_humidity() {
@@ -96,49 +186,434 @@ float si7021_read_humidity() {
 	if (raw_humidity == 0) {
 		return -999;
 	}
+	return __si7021_raw_to_humidity(raw_humidity);
+}
+
+float __si7021_raw_to_temperature(uint16_t raw_temp) {
+	return (raw_temp * 175.72 / 65536.0) - 46.85;
+}
+
+float __si7021_raw_to_humidity(uint16_t raw_humidity) {
 	return (125.0 * raw_humidity / 65536.0) - 6.0;
 }
 
+float __si7021_read_cached(uint8_t quantity, uint32_t max_age_us) {
+	uint32_t generation;
+	float value;
+	int64_t now = esp_timer_get_time();
+
+	portENTER_CRITICAL(&__si7021_cache_lock);
+	if (__si7021_cache_valid[quantity]
+			&& now - __si7021_cache_time[quantity] <= (int64_t) max_age_us) {
+		__si7021_cache_stats.hits++;
+		value = __si7021_cache_value[quantity];
+		portEXIT_CRITICAL(&__si7021_cache_lock);
+		return value;
+	}
+	generation = __si7021_cache_generation[quantity];
+	portEXIT_CRITICAL(&__si7021_cache_lock);
+
+	__si7021_bus_lock();
+	portENTER_CRITICAL(&__si7021_cache_lock);
+	if (__si7021_cache_generation[quantity] != generation) {
+		// another caller measured while we waited for the bus
+		__si7021_cache_stats.coalesced++;
+		value = __si7021_cache_valid[quantity] ?
+				__si7021_cache_value[quantity] : -999;
+		portEXIT_CRITICAL(&__si7021_cache_lock);
+		__si7021_bus_unlock();
+		return value;
+	}
+	__si7021_cache_stats.misses++;
+	portEXIT_CRITICAL(&__si7021_cache_lock);
+
+	if (quantity == SI7021_CACHE_TEMPERATURE) {
+		value = si7021_read_temperature();
+	} else {
+		value = si7021_read_humidity();
+	}
+	__si7021_cache_store(quantity, value);
+	__si7021_bus_unlock();
+	return value;
+}
+
+void __si7021_cache_store(uint8_t quantity, float value) {
+	int64_t now = esp_timer_get_time();
+	portENTER_CRITICAL(&__si7021_cache_lock);
+	// failures are shared with waiting callers too, but never served as fresh
+	__si7021_cache_valid[quantity] = (value != -999);
+	__si7021_cache_value[quantity] = value;
+	__si7021_cache_time[quantity] = now;
+	__si7021_cache_generation[quantity]++;
+	portEXIT_CRITICAL(&__si7021_cache_lock);
+}
+
+float si7021_read_temperature_cached(uint32_t max_age_us) {
+	return __si7021_read_cached(SI7021_CACHE_TEMPERATURE, max_age_us);
+}
+
+float si7021_read_humidity_cached(uint32_t max_age_us) {
+	return __si7021_read_cached(SI7021_CACHE_HUMIDITY, max_age_us);
+}
+
+si7021_err_t si7021_read_pair_cached(uint32_t max_age_us, float *temperature,
+		float *humidity) {
+	uint32_t temp_generation, rh_generation;
+	uint16_t raw_humidity, raw_temp;
+	int64_t now = esp_timer_get_time();
+
+	if (temperature == NULL || humidity == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+
+	portENTER_CRITICAL(&__si7021_cache_lock);
+	if (__si7021_cache_valid[SI7021_CACHE_TEMPERATURE]
+			&& __si7021_cache_valid[SI7021_CACHE_HUMIDITY]
+			&& now - __si7021_cache_time[SI7021_CACHE_TEMPERATURE]
+					<= (int64_t) max_age_us
+			&& now - __si7021_cache_time[SI7021_CACHE_HUMIDITY]
+					<= (int64_t) max_age_us) {
+		__si7021_cache_stats.hits++;
+		*temperature = __si7021_cache_value[SI7021_CACHE_TEMPERATURE];
+		*humidity = __si7021_cache_value[SI7021_CACHE_HUMIDITY];
+		portEXIT_CRITICAL(&__si7021_cache_lock);
+		return SI7021_ERR_OK;
+	}
+	temp_generation = __si7021_cache_generation[SI7021_CACHE_TEMPERATURE];
+	rh_generation = __si7021_cache_generation[SI7021_CACHE_HUMIDITY];
+	portEXIT_CRITICAL(&__si7021_cache_lock);
+
+	__si7021_bus_lock();
+	portENTER_CRITICAL(&__si7021_cache_lock);
+	if (__si7021_cache_generation[SI7021_CACHE_TEMPERATURE] != temp_generation
+			&& __si7021_cache_generation[SI7021_CACHE_HUMIDITY]
+					!= rh_generation) {
+		__si7021_cache_stats.coalesced++;
+		*temperature = __si7021_cache_value[SI7021_CACHE_TEMPERATURE];
+		*humidity = __si7021_cache_value[SI7021_CACHE_HUMIDITY];
+		bool valid = __si7021_cache_valid[SI7021_CACHE_TEMPERATURE]
+				&& __si7021_cache_valid[SI7021_CACHE_HUMIDITY];
+		portEXIT_CRITICAL(&__si7021_cache_lock);
+		__si7021_bus_unlock();
+		return valid ? SI7021_ERR_OK : SI7021_ERR_FAIL;
+	}
+	__si7021_cache_stats.misses++;
+	portEXIT_CRITICAL(&__si7021_cache_lock);
+
+	si7021_err_t err = __si7021_read_pair(temperature, humidity);
+	__si7021_bus_unlock();
+	return err;
+}
+
+si7021_err_t __si7021_read_pair(float *temperature, float *humidity) {
+	uint16_t raw_humidity, raw_temp;
+
+	__si7021_bus_lock();
+	// a RH measurement also measures temperature, read it back without a second conversion
+	raw_humidity = __si7021_read(SI7021_MEASRH_NOHOLD_CMD);
+	raw_temp = raw_humidity == 0 ? 0 : __si7021_read_previous_temperature();
+	*humidity = raw_humidity == 0 ? -999 : __si7021_raw_to_humidity(raw_humidity);
+	*temperature = raw_temp == 0 ? -999 : __si7021_raw_to_temperature(raw_temp);
+	__si7021_cache_store(SI7021_CACHE_HUMIDITY, *humidity);
+	__si7021_cache_store(SI7021_CACHE_TEMPERATURE, *temperature);
+	__si7021_bus_unlock();
+	if (raw_humidity == 0 || raw_temp == 0) {
+		return SI7021_ERR_FAIL;
+	}
+	return SI7021_ERR_OK;
+}
+
+void si7021_get_cache_stats(si7021_cache_stats_t *stats) {
+	portENTER_CRITICAL(&__si7021_cache_lock);
+	*stats = __si7021_cache_stats;
+	portEXIT_CRITICAL(&__si7021_cache_lock);
+}
+
+void si7021_reset_cache_stats() {
+	portENTER_CRITICAL(&__si7021_cache_lock);
+	__si7021_cache_stats.hits = 0;
+	__si7021_cache_stats.misses = 0;
+	__si7021_cache_stats.coalesced = 0;
+	portEXIT_CRITICAL(&__si7021_cache_lock);
+}
+
+void __si7021_bus_lock() {
+	if (__si7021_bus_mutex != NULL) {
+		xSemaphoreTakeRecursive(__si7021_bus_mutex, portMAX_DELAY);
+	}
+}
+
+bool __si7021_bus_try_lock(TickType_t ticks_to_wait) {
+	if (__si7021_bus_mutex == NULL) {
+		return true;
+	}
+	return xSemaphoreTakeRecursive(__si7021_bus_mutex, ticks_to_wait) == pdTRUE;
+}
+
+void __si7021_bus_unlock() {
+	if (__si7021_bus_mutex != NULL) {
+		xSemaphoreGiveRecursive(__si7021_bus_mutex);
+	}
+}
+
+uint16_t __si7021_read_previous_temperature() {
+	esp_err_t err;
+	uint8_t command = SI7021_READPREVTEMP_CMD;
+	uint8_t response[2];
+
+	__si7021_bus_lock();
+	err = __si7021_bus_write(&command, 1, SI7021_I2C_TIMEOUT_TICKS);
+	if (err == ESP_OK) {
+		err = __si7021_bus_read(response, sizeof(response),
+				SI7021_I2C_TIMEOUT_TICKS);
+	}
+	__si7021_bus_unlock();
+	if (err != ESP_OK) {
+		return 0;
+	}
+	return (((uint16_t) response[0] << 8) | (uint16_t) response[1]) & 0xFFFC;
+}
+
+void __si7021_wait_idle(int64_t latest_us) {
+	if (__si7021_busy_until_us != 0) {
+		__si7021_sleep_until(__si7021_busy_until_us, latest_us);
+	}
+	__si7021_busy_until_us = 0;
+}
+
+void __si7021_sleep_until(int64_t time_us, int64_t latest_us) {
+	int64_t now = esp_timer_get_time();
+	int64_t wait_us = time_us - now;
+	if (wait_us <= 0) {
+		return;
+	}
+	// vTaskDelay(n) blocks for n - 1 to n tick periods
+	TickType_t ticks = (wait_us + SI7021_TICK_US - 1) / SI7021_TICK_US + 1;
+	if (latest_us - now >= (int64_t) ticks * SI7021_TICK_US) {
+		vTaskDelay(ticks);
+		return;
+	}
+	if (wait_us >= SI7021_TICK_US) {
+		vTaskDelay(wait_us / SI7021_TICK_US);
+		wait_us = time_us - esp_timer_get_time();
+	}
+	if (wait_us > 0) {
+		esp_rom_delay_us(wait_us);
+	}
+}
+
+TickType_t __si7021_ticks_until(int64_t deadline_us) {
+	int64_t ticks = (deadline_us - esp_timer_get_time()) / SI7021_TICK_US;
+	return ticks < 0 ? 0 : (TickType_t) ticks;
+}
+
+si7021_err_t __si7021_esp_err(esp_err_t err) {
+	switch (err) {
+	case ESP_OK:
+		return SI7021_ERR_OK;
+	case ESP_ERR_INVALID_ARG:
+		return SI7021_ERR_INVALID_ARG;
+	case ESP_ERR_INVALID_STATE:
+		return SI7021_ERR_INVALID_STATE;
+	case ESP_ERR_TIMEOUT:
+		return SI7021_ERR_DEADLINE;
+	}
+	return SI7021_ERR_FAIL;
+}
+
+si7021_err_t __si7021_read_deadline(uint8_t command, int64_t deadline_us,
+		uint16_t *raw_value) {
+	esp_err_t err;
+	uint8_t response[3];
+	bool crc_valid;
+	int64_t command_start, poll_at;
+	uint32_t typical_us, conversion_us;
+
+	if (command == SI7021_MEASRH_NOHOLD_CMD) {
+		typical_us = SI7021_TYP_RH_US;
+		conversion_us = SI7021_CONV_RH_US;
+	} else {
+		typical_us = SI7021_TYP_TEMP_US;
+		conversion_us = SI7021_CONV_TEMP_US;
+	}
+
+	// 0 ticks is a plain try, so waiting for the bus never overruns either
+	if (!__si7021_bus_try_lock(
+			__si7021_ticks_until(
+					deadline_us - SI7021_COMMAND_US - typical_us
+							- SI7021_PHASE_US))) {
+		return SI7021_ERR_DEADLINE;
+	}
+	// the command, a typical conversion and one poll must fit, after any conversion
+	// abandoned by an earlier deadline since the sensor NACKs new commands until then
+	command_start = esp_timer_get_time();
+	if (command_start < __si7021_busy_until_us) {
+		command_start = __si7021_busy_until_us;
+	}
+	if (command_start + SI7021_COMMAND_US + typical_us + SI7021_PHASE_US
+			> deadline_us) {
+		__si7021_bus_unlock();
+		return SI7021_ERR_DEADLINE;
+	}
+	// block rather than spin only while even a slowest conversion would still fit
+	__si7021_wait_idle(
+			deadline_us - SI7021_COMMAND_US - conversion_us - SI7021_PHASE_US);
+
+	// tells a replay which API issued the command and with which deadline
+	__si7021_trace_record(SI7021_TRACE_OP_DEADLINE, &command, 1, ESP_OK,
+			deadline_us);
+	// the schedule hangs off the recorded start of the command, so a replay derives the same
+	command_start = esp_timer_get_time();
+	err = __si7021_bus_write(&command, 1, __si7021_ticks_until(deadline_us));
+	if (err != ESP_OK) {
+		__si7021_bus_unlock();
+		return __si7021_esp_err(err);
+	}
+
+	// the sensor NACKs its address until the conversion is done, poll on a fixed schedule
+	// so a slow conversion costs a poll per SI7021_DEADLINE_POLL_US, not a busy loop
+	poll_at = command_start + SI7021_COMMAND_US + typical_us;
+	do {
+		if (poll_at + SI7021_PHASE_US > deadline_us) {
+			err = ESP_ERR_TIMEOUT;
+			break;
+		}
+		// at most one interval late, which also keeps a tick long poll within the deadline
+		__si7021_sleep_until(poll_at,
+				poll_at + SI7021_DEADLINE_POLL_US
+						< deadline_us - SI7021_PHASE_US ?
+						poll_at + SI7021_DEADLINE_POLL_US :
+						deadline_us - SI7021_PHASE_US);
+		if (esp_timer_get_time() + SI7021_PHASE_US > deadline_us) {
+			err = ESP_ERR_TIMEOUT;
+			break;
+		}
+		err = __si7021_bus_read(response, sizeof(response),
+				__si7021_ticks_until(deadline_us));
+		poll_at += SI7021_DEADLINE_POLL_US;
+	} while (err == ESP_FAIL);
+	if (err != ESP_OK) {
+		__si7021_busy_until_us = command_start + SI7021_COMMAND_US
+				+ conversion_us;
+		__si7021_bus_unlock();
+		return __si7021_esp_err(err);
+	}
+
+	*raw_value = ((uint16_t) response[0] << 8) | (uint16_t) response[1];
+	crc_valid = __is_crc_valid(*raw_value, response[2]);
+	// still holding the bus, so the last recorded phase is our read
+	__si7021_trace_mark_crc(crc_valid);
+	__si7021_bus_unlock();
+	if (!crc_valid) {
+		return SI7021_ERR_FAIL;
+	}
+	*raw_value &= 0xFFFC;
+	return SI7021_ERR_OK;
+}
+
+si7021_err_t si7021_read_temperature_deadline(int64_t deadline_us,
+		float *temperature) {
+	uint16_t raw_temp;
+	if (temperature == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	si7021_err_t err = __si7021_read_deadline(SI7021_MEASTEMP_NOHOLD_CMD,
+			deadline_us, &raw_temp);
+	if (err != SI7021_ERR_OK) {
+		return err;
+	}
+	*temperature = __si7021_raw_to_temperature(raw_temp);
+	return SI7021_ERR_OK;
+}
+
+si7021_err_t si7021_read_humidity_deadline(int64_t deadline_us,
+		float *humidity) {
+	uint16_t raw_humidity;
+	if (humidity == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	si7021_err_t err = __si7021_read_deadline(SI7021_MEASRH_NOHOLD_CMD,
+			deadline_us, &raw_humidity);
+	if (err != SI7021_ERR_OK) {
+		return err;
+	}
+	*humidity = __si7021_raw_to_humidity(raw_humidity);
+	return SI7021_ERR_OK;
+}
+
 uint16_t __si7021_read(uint8_t command) {
 
 	esp_err_t err;
-	uint8_t msb, lsb, crc;
+	uint8_t response[3];
 	uint16_t raw_value;
+	bool crc_valid;
 
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, command, true);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	__si7021_bus_lock();
+	err = __si7021_bus_write(&command, 1, SI7021_I2C_TIMEOUT_TICKS);
 	if (err != ESP_OK) {
+		__si7021_bus_unlock();
 		return 0;
 	}
 
 	vTaskDelay(50 / portTICK_PERIOD_MS);
 
-	cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_READ, true);
-	i2c_master_read_byte(cmd, &msb, 0x00);
-	i2c_master_read_byte(cmd, &lsb, 0x00);
-	i2c_master_read_byte(cmd, &crc, 0x01);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	err = __si7021_bus_read(response, sizeof(response),
+			SI7021_I2C_TIMEOUT_TICKS);
 	if (err != ESP_OK) {
+		__si7021_bus_unlock();
 		return 0;
 	}
 
-	raw_value = ((uint16_t) msb << 8) | (uint16_t) lsb;
-	if (!__is_crc_valid(raw_value, crc))
+	raw_value = ((uint16_t) response[0] << 8) | (uint16_t) response[1];
+	crc_valid = __is_crc_valid(raw_value, response[2]);
+	// still holding the bus, so the last recorded phase is our read
+	__si7021_trace_mark_crc(crc_valid);
+	__si7021_bus_unlock();
+	if (!crc_valid)
 		printf("CRC invalid\r\n");
 	return raw_value & 0xFFFC;
 }
 
+esp_err_t __si7021_bus_write(const uint8_t *data, size_t len,
+		TickType_t ticks_to_wait) {
+	esp_err_t err;
+	// the sensor NACKs every command until a conversion abandoned at a deadline is done;
+	// deadline reads have already waited within their budget, so this is a no-op for them
+	__si7021_wait_idle(INT64_MAX);
+	int64_t start = esp_timer_get_time();
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+	i2c_master_start(cmd);
+	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
+	for (size_t i = 0; i < len; i++) {
+		i2c_master_write_byte(cmd, data[i], true);
+	}
+	i2c_master_stop(cmd);
+	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd, ticks_to_wait);
+	i2c_cmd_link_delete(cmd);
+	__si7021_bus_transactions++;
+	__si7021_bus_time_us += (uint32_t) (esp_timer_get_time() - start);
+	__si7021_trace_record(SI7021_TRACE_OP_WRITE, data, len, err, start);
+	return err;
+}
+
+esp_err_t __si7021_bus_read(uint8_t *data, size_t len, TickType_t ticks_to_wait) {
+	esp_err_t err;
+	int64_t start = esp_timer_get_time();
+	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+	i2c_master_start(cmd);
+	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_READ, true);
+	for (size_t i = 0; i < len; i++) {
+		i2c_master_read_byte(cmd, &data[i], (i + 1 == len) ? 0x01 : 0x00);
+	}
+	i2c_master_stop(cmd);
+	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd, ticks_to_wait);
+	i2c_cmd_link_delete(cmd);
+	__si7021_bus_transactions++;
+	__si7021_bus_time_us += (uint32_t) (esp_timer_get_time() - start);
+	__si7021_trace_record(SI7021_TRACE_OP_READ, data, len, err, start);
+	return err;
+}
+
 bool __is_crc_valid(uint16_t value, uint8_t crc) {
 
 	// line the bits representing the input in a row (first data, then crc)
@@ -166,15 +641,17 @@ bool __is_crc_valid(uint16_t value, uint8_t crc) {
 
 uint8_t si7021_soft_reset() {
 	esp_err_t err;
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, SI7021_SOFT_RESET_CMD, true);
-	i2c_master_stop(cmd);
+	uint8_t command = SI7021_SOFT_RESET_CMD;
 
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	__si7021_bus_lock();
+	err = __si7021_bus_write(&command, 1, SI7021_I2C_TIMEOUT_TICKS);
+	// registers are back to their reset values, heater off included
+	__si7021_user_reg_valid = false;
+	__si7021_heater_reg_valid = false;
+	if (err == ESP_OK && __si7021_heater_on) {
+		__si7021_heater_set_state(false);
+	}
+	__si7021_bus_unlock();
 	switch (err) {
 	case ESP_ERR_INVALID_ARG:
 		return SI7021_ERR_INVALID_ARG;
@@ -192,37 +669,39 @@ uint8_t si7021_soft_reset() {
 }
 uint8_t __si7021_read_user_register() {
 	esp_err_t err;
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, SI7021_READRHT_REG_CMD, true);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
-	if (err != ESP_OK) {
-		return 0;
-	}
+	uint8_t command = SI7021_READRHT_REG_CMD;
 	uint8_t reg_value;
-	cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_READ, true);
-	i2c_master_read_byte(cmd, &reg_value, 0x01);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	__si7021_bus_lock();
+	err = __si7021_bus_write(&command, 1, SI7021_I2C_TIMEOUT_TICKS);
+	if (err == ESP_OK) {
+		err = __si7021_bus_read(&reg_value, 1, SI7021_I2C_TIMEOUT_TICKS);
+	}
 	if (err != ESP_OK) {
+		__si7021_bus_unlock();
 		return 0;
 	}
+	__si7021_user_reg_update(reg_value);
+	__si7021_bus_unlock();
 	return reg_value;
 }
 
+void __si7021_user_reg_update(uint8_t value) {
+	bool on = (value & (1 << 2)) != 0;
+	__si7021_user_reg_shadow = value;
+	__si7021_user_reg_valid = true;
+	// heater state follows the register, so si7021_set_heater_status() is tracked too
+	if (on != __si7021_heater_on) {
+		__si7021_heater_set_state(on);
+	}
+}
+
 SI7021_RESOLUTION si7021_get_resolution() {
 	uint8_t reg_value = __si7021_read_user_register();
 	return reg_value & 0x81;
 }
 si7021_err_t si7021_set_resolution(SI7021_RESOLUTION resolution) {
+	si7021_err_t err;
+	__si7021_bus_lock();
 	uint8_t current_reg_value = __si7021_read_user_register();
 	if (resolution & (1 << 0)) {
 		current_reg_value = (current_reg_value & ~(1 << 0)) | (1 << 0);
@@ -234,21 +713,23 @@ si7021_err_t si7021_set_resolution(SI7021_RESOLUTION resolution) {
 	} else {
 		current_reg_value = (current_reg_value & ~(1 << 7)) | (0 << 7);
 	}
-	return __si7021_write_user_register(current_reg_value);
+	err = __si7021_write_user_register(current_reg_value);
+	__si7021_bus_unlock();
+	return err;
 }
 
 si7021_err_t __si7021_write_user_register(uint8_t value) {
 	esp_err_t err;
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+	uint8_t data[2] = { SI7021_WRITERHT_REG_CMD, value };
 
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, SI7021_WRITERHT_REG_CMD, true);
-	i2c_master_write_byte(cmd, value, true);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	__si7021_bus_lock();
+	err = __si7021_bus_write(data, sizeof(data), SI7021_I2C_TIMEOUT_TICKS);
+	if (err == ESP_OK) {
+		__si7021_user_reg_update(value);
+	} else {
+		__si7021_user_reg_valid = false;
+	}
+	__si7021_bus_unlock();
 
 	switch (err) {
 
@@ -269,26 +750,17 @@ si7021_err_t __si7021_write_user_register(uint8_t value) {
 uint8_t si7021_read_firmware_rev() {
 	esp_err_t err;
 	uint8_t firmware_rev;
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, (uint8_t) (SI7021_FIRMVERS_CMD >> 8), true);
-	i2c_master_write_byte(cmd, (uint8_t) (SI7021_FIRMVERS_CMD & 0xFF), true);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	uint8_t command[2] = { (uint8_t) (SI7021_FIRMVERS_CMD >> 8),
+			(uint8_t) (SI7021_FIRMVERS_CMD & 0xFF) };
+	__si7021_bus_lock();
+	err = __si7021_bus_write(command, sizeof(command),
+			SI7021_I2C_TIMEOUT_TICKS);
 	if (err != ESP_OK) {
+		__si7021_bus_unlock();
 		return 0xEE;
 	}
-	cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_READ, true);
-	i2c_master_read_byte(cmd, &firmware_rev, 0x01);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	err = __si7021_bus_read(&firmware_rev, 1, SI7021_I2C_TIMEOUT_TICKS);
+	__si7021_bus_unlock();
 	if (err != ESP_OK) {
 		return 0xDE;
 	}
@@ -311,41 +783,31 @@ uint8_t si7021_get_heater_status() {
 uint8_t si7021_get_heater_register() {
 	esp_err_t err;
 	uint8_t heater_register;
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, SI7021_READHEATER_REG_CMD, true);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	uint8_t command = SI7021_READHEATER_REG_CMD;
+	__si7021_bus_lock();
+	err = __si7021_bus_write(&command, 1, SI7021_I2C_TIMEOUT_TICKS);
 	if (err != ESP_OK) {
+		__si7021_bus_unlock();
 		return 0xFF;
 	}
-	cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_READ, true);
-	i2c_master_read_byte(cmd, &heater_register, 0x01);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	err = __si7021_bus_read(&heater_register, 1, SI7021_I2C_TIMEOUT_TICKS);
 	if (err != ESP_OK) {
+		__si7021_bus_unlock();
 		return 0xEE;
 	}
+	__si7021_heater_reg_shadow = heater_register & 0xF;
+	__si7021_heater_reg_valid = true;
+	__si7021_bus_unlock();
 	return heater_register;
 }
 si7021_err_t si7021_set_heater_register(uint8_t value) {
 	esp_err_t err;
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, SI7021_WRITEHEATER_REG_CMD, true);
-	i2c_master_write_byte(cmd, value & 0xF, true);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	uint8_t data[2] = { SI7021_WRITEHEATER_REG_CMD, value & 0xF };
+	__si7021_bus_lock();
+	err = __si7021_bus_write(data, sizeof(data), SI7021_I2C_TIMEOUT_TICKS);
+	__si7021_heater_reg_shadow = value & 0xF;
+	__si7021_heater_reg_valid = (err == ESP_OK);
+	__si7021_bus_unlock();
 	switch (err) {
 	case ESP_ERR_INVALID_ARG:
 		return SI7021_ERR_INVALID_ARG;
@@ -359,77 +821,568 @@ si7021_err_t si7021_set_heater_register(uint8_t value) {
 	return SI7021_ERR_OK;
 }
 si7021_err_t si7021_set_heater_status(uint8_t value) {
+	si7021_err_t err;
+	__si7021_bus_lock();
+	uint32_t transactions = __si7021_bus_transactions;
+	uint32_t bus_us = __si7021_bus_time_us;
 	uint8_t current_reg_value = __si7021_read_user_register();
 	if (value == SI7021_HEATER_ON) {
 		current_reg_value = (current_reg_value & ~(1 << 2)) | (1 << 2);
 	} else if (value == SI7021_HEATER_OFF) {
 		current_reg_value = (current_reg_value & ~(1 << 2)) | (0 << 2);
 	}
-	return __si7021_write_user_register(current_reg_value);
+	err = __si7021_write_user_register(current_reg_value);
+	// baseline for the controller's own cost in si7021_heater_stats_t
+	portENTER_CRITICAL(&__si7021_heater_lock);
+	if (err == SI7021_ERR_OK) {
+		__si7021_heater_stats.manual_switches++;
+	}
+	__si7021_heater_stats.manual_transactions += __si7021_bus_transactions
+			- transactions;
+	__si7021_heater_stats.manual_bus_us += __si7021_bus_time_us - bus_us;
+	portEXIT_CRITICAL(&__si7021_heater_lock);
+	__si7021_bus_unlock();
+	return err;
 }
 uint64_t get_electronic_id() {
 	uint64_t id = 0;
 	esp_err_t err;
-	uint8_t sna_3, sna_2, sna_1, sna_0, snb_3, snb_2, snb_1, snb_0;
-	i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, SI7021_ID1_CMD >> 8, true);
-	i2c_master_write_byte(cmd, SI7021_ID1_CMD & 0xFF, true);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
-	if (err != ESP_OK) {
-		return 0xFFFFFFFFFFFFFFFF;
+	uint8_t sna[4], snb[4];
+	uint8_t command[2] = { SI7021_ID1_CMD >> 8, SI7021_ID1_CMD & 0xFF };
+	__si7021_bus_lock();
+	err = __si7021_bus_write(command, sizeof(command),
+			SI7021_I2C_TIMEOUT_TICKS);
+	if (err == ESP_OK) {
+		err = __si7021_bus_read(sna, sizeof(sna), SI7021_I2C_TIMEOUT_TICKS);
 	}
-	cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_READ, true);
-	i2c_master_read_byte(cmd, &sna_3, 0x00);
-	i2c_master_read_byte(cmd, &sna_2, 0x00);
-	i2c_master_read_byte(cmd, &sna_1, 0x00);
-	i2c_master_read_byte(cmd, &sna_0, 0x01);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
-	if (err != ESP_OK) {
-		return 0xFFFFFFFFFFFFFFFF;
+	if (err == ESP_OK) {
+		command[0] = SI7021_ID2_CMD >> 8;
+		command[1] = SI7021_ID2_CMD & 0xFF;
+		err = __si7021_bus_write(command, sizeof(command),
+				SI7021_I2C_TIMEOUT_TICKS);
 	}
-	cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_WRITE, true);
-	i2c_master_write_byte(cmd, SI7021_ID2_CMD >> 8, true);
-	i2c_master_write_byte(cmd, SI7021_ID2_CMD & 0xFF, true);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
-	if (err != ESP_OK) {
-		return 0xFFFFFFFFFFFFFFFF;
+	if (err == ESP_OK) {
+		err = __si7021_bus_read(snb, sizeof(snb), SI7021_I2C_TIMEOUT_TICKS);
 	}
-	cmd = i2c_cmd_link_create();
-	i2c_master_start(cmd);
-	i2c_master_write_byte(cmd, (SI7021_ADDR << 1) | I2C_MASTER_READ, true);
-	i2c_master_read_byte(cmd, &snb_3, 0x00);
-	i2c_master_read_byte(cmd, &snb_2, 0x00);
-	i2c_master_read_byte(cmd, &snb_1, 0x00);
-	i2c_master_read_byte(cmd, &snb_0, 0x01);
-	i2c_master_stop(cmd);
-	err = i2c_master_cmd_begin(__si7021_config.si7021_port, cmd,
-			1000 / portTICK_PERIOD_MS);
-	i2c_cmd_link_delete(cmd);
+	__si7021_bus_unlock();
 	if (err != ESP_OK) {
 		return 0xFFFFFFFFFFFFFFFF;
 	}
-	id = (uint64_t) sna_3 << 56;
-	id |= (uint64_t) sna_2 << 48;
-	id |= (uint64_t) sna_1 << 40;
-	id |= (uint64_t) sna_0 << 32;
-	id |= (uint64_t) snb_3 << 24;
-	id |= (uint64_t) snb_2 << 16;
-	id |= (uint64_t) snb_1 << 8;
-	id |= (uint64_t) snb_0;
+	id = (uint64_t) sna[0] << 56;
+	id |= (uint64_t) sna[1] << 48;
+	id |= (uint64_t) sna[2] << 40;
+	id |= (uint64_t) sna[3] << 32;
+	id |= (uint64_t) snb[0] << 24;
+	id |= (uint64_t) snb[1] << 16;
+	id |= (uint64_t) snb[2] << 8;
+	id |= (uint64_t) snb[3];
 	return id;
 }
+
+void __si7021_trace_record(uint8_t op, const uint8_t *data, size_t len,
+		esp_err_t err, int64_t timestamp_us) {
+	if (!__si7021_trace_enabled) {
+		return;
+	}
+	if (len > SI7021_TRACE_MAX_DATA) {
+		len = SI7021_TRACE_MAX_DATA;
+	}
+	portENTER_CRITICAL(&__si7021_trace_lock);
+	si7021_trace_entry_t *entry = &__si7021_trace_ring[__si7021_trace_total
+			& SI7021_TRACE_MASK];
+	entry->timestamp_us = (uint32_t) timestamp_us;
+	entry->err = (int16_t) err;
+	entry->op = op;
+	entry->len = (uint8_t) len;
+	memset(entry->data, 0, sizeof(entry->data));
+	// data of a failed read is undefined, keep the record deterministic
+	if (op == SI7021_TRACE_OP_WRITE || err == ESP_OK) {
+		memcpy(entry->data, data, len);
+	}
+	entry->crc = SI7021_TRACE_CRC_NONE;
+	entry->reserved = 0;
+	__si7021_trace_total++;
+	portEXIT_CRITICAL(&__si7021_trace_lock);
+}
+
+void __si7021_trace_mark_crc(bool valid) {
+	if (!__si7021_trace_enabled) {
+		return;
+	}
+	portENTER_CRITICAL(&__si7021_trace_lock);
+	if (__si7021_trace_total != 0) {
+		si7021_trace_entry_t *entry = &__si7021_trace_ring[(__si7021_trace_total
+				- 1) & SI7021_TRACE_MASK];
+		if (entry->op == SI7021_TRACE_OP_READ) {
+			entry->crc = valid ? SI7021_TRACE_CRC_OK : SI7021_TRACE_CRC_BAD;
+		}
+	}
+	portEXIT_CRITICAL(&__si7021_trace_lock);
+}
+
+void si7021_trace_enable(bool enable) {
+	__si7021_trace_enabled = enable;
+}
+
+void si7021_trace_clear() {
+	portENTER_CRITICAL(&__si7021_trace_lock);
+	__si7021_trace_total = 0;
+	portEXIT_CRITICAL(&__si7021_trace_lock);
+}
+
+size_t si7021_trace_snapshot(si7021_trace_entry_t *entries, size_t max_entries,
+		uint32_t *dropped) {
+	uint32_t total, count, first;
+	portENTER_CRITICAL(&__si7021_trace_lock);
+	total = __si7021_trace_total;
+	count = total < SI7021_TRACE_DEPTH ? total : SI7021_TRACE_DEPTH;
+	if (count > max_entries) {
+		count = max_entries;
+	}
+	first = total - count;
+	for (uint32_t i = 0; i < count; i++) {
+		entries[i] = __si7021_trace_ring[(first + i) & SI7021_TRACE_MASK];
+	}
+	portEXIT_CRITICAL(&__si7021_trace_lock);
+	if (dropped != NULL) {
+		*dropped = first;
+	}
+	return count;
+}
+
+si7021_err_t si7021_trace_dump(FILE *file) {
+	si7021_trace_entry_t *entries;
+	si7021_trace_header_t header;
+	uint32_t dropped;
+	size_t count;
+
+	if (file == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	entries = malloc(sizeof(si7021_trace_entry_t) * SI7021_TRACE_DEPTH);
+	if (entries == NULL) {
+		return SI7021_ERR_FAIL;
+	}
+	count = si7021_trace_snapshot(entries, SI7021_TRACE_DEPTH, &dropped);
+
+	memcpy(header.magic, SI7021_TRACE_MAGIC, sizeof(header.magic));
+	header.version = SI7021_TRACE_VERSION;
+	header.entry_size = sizeof(si7021_trace_entry_t);
+	header.count = (uint16_t) count;
+	header.dropped = dropped;
+	if (fwrite(&header, sizeof(header), 1, file) != 1
+			|| fwrite(entries, sizeof(si7021_trace_entry_t), count, file)
+					!= count) {
+		free(entries);
+		return SI7021_ERR_FAIL;
+	}
+	free(entries);
+	return SI7021_ERR_OK;
+}
+
+si7021_err_t si7021_subscribe_callback(si7021_sample_cb_t callback, void *arg,
+		uint8_t divider, si7021_subscriber_t *subscriber) {
+	if (callback == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	// the bus mutex already exists and serialises the one time creation
+	__si7021_bus_lock();
+	if (__si7021_dispatcher == NULL
+			&& xTaskCreate(__si7021_dispatcher_task, "si7021_dispatch",
+					SI7021_DISPATCHER_STACK, NULL, SI7021_DISPATCHER_PRIORITY,
+					&__si7021_dispatcher) != pdPASS) {
+		__si7021_dispatcher = NULL;
+	}
+	__si7021_bus_unlock();
+	if (__si7021_dispatcher == NULL) {
+		return SI7021_ERR_FAIL;
+	}
+	return __si7021_subscribe(callback, arg, NULL, divider, subscriber);
+}
+
+si7021_err_t si7021_subscribe_task(TaskHandle_t task, uint8_t divider,
+		si7021_subscriber_t *subscriber) {
+	if (task == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	return __si7021_subscribe(NULL, NULL, task, divider, subscriber);
+}
+
+si7021_err_t __si7021_subscribe(si7021_sample_cb_t callback, void *arg,
+		TaskHandle_t task, uint8_t divider, si7021_subscriber_t *subscriber) {
+	if (divider == 0 || subscriber == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	portENTER_CRITICAL(&__si7021_subscriber_lock);
+	for (uint8_t i = 0; i < SI7021_MAX_SUBSCRIBERS; i++) {
+		si7021_subscriber_entry_t *entry = &__si7021_subscribers[i];
+		if (entry->active) {
+			continue;
+		}
+		memset(entry, 0, sizeof(*entry));
+		entry->active = true;
+		entry->callback = callback;
+		entry->arg = arg;
+		entry->task = task;
+		entry->divider = divider;
+		entry->countdown = 1;
+		// only samples published from now on count as lag
+		entry->delivered_sequence = __si7021_sample_slot.sequence;
+		entry->read_sequence = __si7021_sample_slot.sequence;
+		portEXIT_CRITICAL(&__si7021_subscriber_lock);
+		*subscriber = i;
+		return SI7021_ERR_OK;
+	}
+	portEXIT_CRITICAL(&__si7021_subscriber_lock);
+	return SI7021_ERR_FAIL;
+}
+
+si7021_err_t si7021_unsubscribe(si7021_subscriber_t subscriber) {
+	if (subscriber >= SI7021_MAX_SUBSCRIBERS) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	portENTER_CRITICAL(&__si7021_subscriber_lock);
+	__si7021_subscribers[subscriber].active = false;
+	portEXIT_CRITICAL(&__si7021_subscriber_lock);
+	return SI7021_ERR_OK;
+}
+
+si7021_err_t si7021_sample_produce() {
+	si7021_sample_t sample;
+	TaskHandle_t tasks[SI7021_MAX_SUBSCRIBERS];
+	uint8_t task_count = 0;
+	bool dispatch = false;
+	si7021_err_t err;
+
+	// at most one register write, the sample below is still taken
+	__si7021_heater_step();
+	// always measures, outside the cache counters that only describe user calls
+	err = __si7021_read_pair(&sample.temperature, &sample.humidity);
+	if (err != SI7021_ERR_OK) {
+		return err;
+	}
+	sample.timestamp_us = esp_timer_get_time();
+	if (!__si7021_heater_adjust(&sample)) {
+		return SI7021_ERR_OK;
+	}
+
+	portENTER_CRITICAL(&__si7021_subscriber_lock);
+	sample.sequence = __si7021_sample_slot.sequence + 1;
+	__si7021_sample_publish(&sample);
+	for (uint8_t i = 0; i < SI7021_MAX_SUBSCRIBERS; i++) {
+		si7021_subscriber_entry_t *entry = &__si7021_subscribers[i];
+		if (!entry->active || --entry->countdown != 0) {
+			continue;
+		}
+		entry->countdown = entry->divider;
+		entry->delivered++;
+		// the previous notification was never followed by a read; reads of samples
+		// skipped by the divider are newer, so compare as serial numbers
+		if ((int32_t) (entry->read_sequence - entry->delivered_sequence) < 0) {
+			entry->dropped++;
+		}
+		entry->delivered_sequence = sample.sequence;
+		if (entry->callback != NULL) {
+			dispatch = true;
+		} else {
+			tasks[task_count++] = entry->task;
+		}
+	}
+	portEXIT_CRITICAL(&__si7021_subscriber_lock);
+
+	// nothing below blocks: tasks, the dispatcher included, are only notified and read the slot
+	for (uint8_t i = 0; i < task_count; i++) {
+		xTaskNotifyGive(tasks[i]);
+	}
+	if (dispatch) {
+		xTaskNotifyGive(__si7021_dispatcher);
+	}
+	return SI7021_ERR_OK;
+}
+
+void __si7021_dispatcher_task(void *arg) {
+	si7021_sample_t sample;
+	si7021_sample_cb_t callback;
+	void *callback_arg;
+
+	for (;;) {
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		if (si7021_sample_latest(&sample) != SI7021_ERR_OK) {
+			continue;
+		}
+		for (uint8_t i = 0; i < SI7021_MAX_SUBSCRIBERS; i++) {
+			si7021_subscriber_entry_t *entry = &__si7021_subscribers[i];
+			portENTER_CRITICAL(&__si7021_subscriber_lock);
+			// a delivery made after the slot was read comes with its own notification
+			if (!entry->active || entry->callback == NULL
+					|| entry->read_sequence == entry->delivered_sequence
+					|| (int32_t) (sample.sequence - entry->delivered_sequence)
+							< 0) {
+				portEXIT_CRITICAL(&__si7021_subscriber_lock);
+				continue;
+			}
+			entry->read_sequence = sample.sequence;
+			callback = entry->callback;
+			callback_arg = entry->arg;
+			portEXIT_CRITICAL(&__si7021_subscriber_lock);
+			callback(&sample, callback_arg);
+		}
+	}
+}
+
+void __si7021_sample_publish(const si7021_sample_t *sample) {
+	uint32_t sequence = __si7021_sample_seqlock + 1;
+	__atomic_store_n(&__si7021_sample_seqlock, sequence, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	__si7021_sample_slot = *sample;
+	__atomic_store_n(&__si7021_sample_seqlock, sequence + 1, __ATOMIC_RELEASE);
+}
+
+si7021_err_t si7021_sample_latest(si7021_sample_t *sample) {
+	uint32_t begin, end;
+	if (sample == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	do {
+		begin = __atomic_load_n(&__si7021_sample_seqlock, __ATOMIC_ACQUIRE);
+		*sample = __si7021_sample_slot;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		end = __atomic_load_n(&__si7021_sample_seqlock, __ATOMIC_RELAXED);
+	} while ((begin & 1) || begin != end);
+	if (sample->sequence == 0) {
+		return SI7021_ERR_INVALID_STATE;
+	}
+	return SI7021_ERR_OK;
+}
+
+si7021_err_t si7021_subscriber_read(si7021_subscriber_t subscriber,
+		si7021_sample_t *sample) {
+	if (subscriber >= SI7021_MAX_SUBSCRIBERS) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	si7021_err_t err = si7021_sample_latest(sample);
+	if (err != SI7021_ERR_OK) {
+		return err;
+	}
+	portENTER_CRITICAL(&__si7021_subscriber_lock);
+	__si7021_subscribers[subscriber].read_sequence = sample->sequence;
+	portEXIT_CRITICAL(&__si7021_subscriber_lock);
+	return SI7021_ERR_OK;
+}
+
+si7021_err_t si7021_get_subscriber_stats(si7021_subscriber_t subscriber,
+		si7021_subscriber_stats_t *stats) {
+	if (subscriber >= SI7021_MAX_SUBSCRIBERS || stats == NULL) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	portENTER_CRITICAL(&__si7021_subscriber_lock);
+	si7021_subscriber_entry_t *entry = &__si7021_subscribers[subscriber];
+	if (!entry->active) {
+		portEXIT_CRITICAL(&__si7021_subscriber_lock);
+		return SI7021_ERR_INVALID_STATE;
+	}
+	stats->delivered = entry->delivered;
+	stats->dropped = entry->dropped;
+	stats->lag = __si7021_sample_slot.sequence - entry->read_sequence;
+	portEXIT_CRITICAL(&__si7021_subscriber_lock);
+	return SI7021_ERR_OK;
+}
+
+si7021_err_t si7021_heater_start(const si7021_heater_config_t *config) {
+	si7021_err_t err = SI7021_ERR_OK;
+	if (config == NULL || config->current > 0xF || config->period_ms == 0
+			|| config->on_ms > config->period_ms
+			|| (config->policy != SI7021_HEATER_EXCLUDE
+					&& config->policy != SI7021_HEATER_COMPENSATE)) {
+		return SI7021_ERR_INVALID_ARG;
+	}
+	__si7021_bus_lock();
+	if (!__si7021_heater_reg_valid
+			|| __si7021_heater_reg_shadow != config->current) {
+		uint32_t transactions = __si7021_bus_transactions;
+		uint32_t bus_us = __si7021_bus_time_us;
+		err = si7021_set_heater_register(config->current);
+		portENTER_CRITICAL(&__si7021_heater_lock);
+		__si7021_heater_stats.transactions += __si7021_bus_transactions
+				- transactions;
+		__si7021_heater_stats.bus_us += __si7021_bus_time_us - bus_us;
+		portEXIT_CRITICAL(&__si7021_heater_lock);
+	}
+	if (err == SI7021_ERR_OK) {
+		// first burst starts on the next step
+		int64_t period_start = esp_timer_get_time()
+				- (int64_t) config->period_ms * 1000;
+		portENTER_CRITICAL(&__si7021_heater_lock);
+		__si7021_heater_config = *config;
+		__si7021_heater_configured = true;
+		__si7021_heater_enabled = true;
+		__si7021_heater_period_start = period_start;
+		__si7021_heater_interval_samples = 0;
+		portEXIT_CRITICAL(&__si7021_heater_lock);
+	}
+	__si7021_bus_unlock();
+	return err;
+}
+
+si7021_err_t si7021_heater_stop() {
+	si7021_err_t err = SI7021_ERR_OK;
+	__si7021_bus_lock();
+	portENTER_CRITICAL(&__si7021_heater_lock);
+	__si7021_heater_enabled = false;
+	portEXIT_CRITICAL(&__si7021_heater_lock);
+	if (__si7021_heater_on) {
+		err = __si7021_heater_switch(false);
+	}
+	__si7021_bus_unlock();
+	return err;
+}
+
+void si7021_get_heater_stats(si7021_heater_stats_t *stats) {
+	portENTER_CRITICAL(&__si7021_heater_lock);
+	*stats = __si7021_heater_stats;
+	if (__si7021_heater_interval_samples > 1) {
+		stats->sample_interval_us = (uint32_t) ((__si7021_heater_last_sample
+				- __si7021_heater_first_sample)
+				/ (__si7021_heater_interval_samples - 1));
+	}
+	portEXIT_CRITICAL(&__si7021_heater_lock);
+}
+
+si7021_err_t __si7021_heater_switch(bool on) {
+	si7021_err_t err = SI7021_ERR_FAIL;
+	uint32_t transactions = __si7021_bus_transactions;
+	uint32_t bus_us = __si7021_bus_time_us;
+	if (!__si7021_user_reg_valid) {
+		// only the first transition after init or reset reads the register
+		__si7021_read_user_register();
+	}
+	if (__si7021_user_reg_valid) {
+		err = __si7021_write_user_register(
+				on ? (__si7021_user_reg_shadow | (1 << 2)) :
+						(__si7021_user_reg_shadow & ~(1 << 2)));
+	}
+	// measured under the bus lock, so the register read is charged to this switch
+	portENTER_CRITICAL(&__si7021_heater_lock);
+	if (err == SI7021_ERR_OK) {
+		__si7021_heater_stats.transitions++;
+	}
+	__si7021_heater_stats.transactions += __si7021_bus_transactions
+			- transactions;
+	__si7021_heater_stats.bus_us += __si7021_bus_time_us - bus_us;
+	portEXIT_CRITICAL(&__si7021_heater_lock);
+	return err;
+}
+
+void __si7021_heater_set_state(bool on) {
+	int64_t now = esp_timer_get_time();
+	portENTER_CRITICAL(&__si7021_heater_lock);
+	float warmth = __si7021_heater_warmth(now);
+	__si7021_heater_on = on;
+	if (on) {
+		__si7021_heater_on_time = now;
+		__si7021_heater_on_warmth = warmth;
+	} else {
+		__si7021_heater_off_time = now;
+		__si7021_heater_off_warmth = warmth;
+	}
+	portEXIT_CRITICAL(&__si7021_heater_lock);
+}
+
+float __si7021_heater_warmth(int64_t time_us) {
+	float progress;
+	if (__si7021_heater_on) {
+		if (__si7021_heater_config.warmup_ms == 0) {
+			return 1.0f;
+		}
+		progress = (float) (time_us - __si7021_heater_on_time)
+				/ ((float) __si7021_heater_config.warmup_ms * 1000.0f);
+		progress = progress > 1.0f ? 1.0f : progress;
+		return __si7021_heater_on_warmth
+				+ (1.0f - __si7021_heater_on_warmth) * progress;
+	}
+	if (__si7021_heater_off_time == 0 || __si7021_heater_config.settle_ms == 0) {
+		return 0.0f;
+	}
+	progress = (float) (time_us - __si7021_heater_off_time)
+			/ ((float) __si7021_heater_config.settle_ms * 1000.0f);
+	return progress >= 1.0f ? 0.0f : __si7021_heater_off_warmth * (1.0f - progress);
+}
+
+void __si7021_heater_step() {
+	int64_t now;
+	__si7021_bus_lock();
+	if (!__si7021_heater_enabled) {
+		__si7021_bus_unlock();
+		return;
+	}
+	now = esp_timer_get_time();
+	if (__si7021_heater_on) {
+		if (now - __si7021_heater_period_start
+				>= (int64_t) __si7021_heater_config.on_ms * 1000) {
+			__si7021_heater_switch(false);
+		}
+	} else if (now - __si7021_heater_period_start
+			>= (int64_t) __si7021_heater_config.period_ms * 1000) {
+		__si7021_heater_period_start = now;
+		if (__si7021_heater_config.on_ms > 0) {
+			__si7021_heater_switch(true);
+		}
+	}
+	__si7021_bus_unlock();
+}
+
+bool __si7021_heater_adjust(si7021_sample_t *sample) {
+	float offset = 0.0f, heated, ambient, humidity;
+	int64_t since_off;
+	bool warm = true;
+	uint8_t policy;
+
+	sample->compensated = false;
+	// no bus lock: only reads state and counts, so producers never wait for a transaction
+	portENTER_CRITICAL(&__si7021_heater_lock);
+	if (!__si7021_heater_configured) {
+		// heater only switched by hand, there is no policy to apply
+		portEXIT_CRITICAL(&__si7021_heater_lock);
+		return true;
+	}
+	__si7021_heater_stats.samples++;
+	if (__si7021_heater_enabled) {
+		if (__si7021_heater_interval_samples++ == 0) {
+			__si7021_heater_first_sample = sample->timestamp_us;
+		}
+		__si7021_heater_last_sample = sample->timestamp_us;
+	}
+	policy = __si7021_heater_config.policy;
+	since_off = sample->timestamp_us - __si7021_heater_off_time;
+	if (__si7021_heater_on
+			|| (__si7021_heater_off_time != 0
+					&& since_off
+							< (int64_t) __si7021_heater_config.settle_ms * 1000)) {
+		offset = __si7021_heater_config.temperature_offset
+				* __si7021_heater_warmth(sample->timestamp_us);
+	} else {
+		warm = false;
+	}
+	if (warm && policy == SI7021_HEATER_EXCLUDE) {
+		__si7021_heater_stats.samples_excluded++;
+	} else if (warm) {
+		__si7021_heater_stats.samples_compensated++;
+	}
+	portEXIT_CRITICAL(&__si7021_heater_lock);
+
+	if (!warm) {
+		return true;
+	}
+	if (policy == SI7021_HEATER_EXCLUDE) {
+		return false;
+	}
+	heated = sample->temperature;
+	ambient = heated - offset;
+	// same water vapour pressure, saturation pressure from the Magnus formula
+	humidity = sample->humidity * expf(17.62f * heated / (243.12f + heated))
+			/ expf(17.62f * ambient / (243.12f + ambient));
+	sample->temperature = ambient;
+	sample->humidity = humidity > 100.0f ? 100.0f : humidity;
+	sample->compensated = true;
+	return true;
+}